@@ -10,6 +10,7 @@
 #include <unordered_set>
 #include <vector>
 #include <stack>
+#include <queue>
 #include <string>
 #include <iomanip>
 #include <iostream>
@@ -18,6 +19,14 @@
 #include <filesystem>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
 
 #define NOMINMAX
 #include <windows.h>
@@ -39,9 +48,9 @@ inline void unused(T const&)
 
 // Rasterizer Core
 #include <BitwiseEnum.hpp>
-#include <ThreadPool.hpp>
 #include <RingBuffer.hpp>
 #include <SafeQueue.hpp>
+#include <JobSystem.hpp>
 #include <PipelineDefinitions.hpp>
 #include <GDIWindow.hpp>
 #include <Singleton.hpp>
@@ -59,6 +68,7 @@ inline void unused(T const&)
 #include <Matrix3x3.hpp>
 #include <Light.hpp>
 #include <RawBuffer.hpp>
+#include <DepthStencilBuffer.hpp>
 #include <Texture.hpp>
 #include <CubeMap.hpp>
 #include <Misc.hpp>
@@ -86,11 +96,13 @@ inline void unused(T const&)
 #include <ShadowShader.hpp>
 #include <LightShader.hpp>
 #include <Material.hpp>
+#include <Mesh.hpp>
+#include <TriangleSetup.hpp>
+#include <RasterKernel.hpp>
 #include <FrameTile.hpp>
 #include <GraphicsCommand.hpp>
 #include <GraphicsDevice.hpp>
 #include <Noise.hpp>
-#include <Mesh.hpp>
 #include <Model.hpp>
 #include <Camera.hpp>
 #include <Renderer.hpp>
@@ -118,6 +130,17 @@ namespace Guarneri
 
 		static void kick_off(Scene& scene)
 		{
+			Graphics().set_thread_affinity(misc_param.thread_affinity);
+			Graphics().set_buffer_layout(misc_param.buffer_layout);
+			Graphics().set_depth_formats(misc_param.depth_format, misc_param.shadow_format);
+			if (misc_param.tile_calibration)
+			{
+				Graphics().calibrate_tiles([&scene]()
+				{
+					scene.render();
+				}, TILE_CALIBRATION_FRAMES);
+			}
+			Graphics().enable_frame_pipelining(misc_param.frame_pipelining);
 			while (Window().is_valid())
 			{
 				Time::frame_start();
@@ -133,7 +156,7 @@ namespace Guarneri
 				}
 				{
 					std::stringstream ss;
-					ss << "Shortcut: " << "F4: FrameTiles, F5:UV, F6:VertexColor, F7:Normal, F8:Specular, F9:Stencil";
+					ss << "Shortcut: " << "F4: FrameTiles, F5:UV, F6:VertexColor, F7:Normal, F8:Specular, F9:Stencil, F10:Mipmap, V:VisibilityBuffer, X:DepthPrepass";
 					Window().draw_text(w, h, ss.str().c_str());
 				}
 				{
@@ -186,6 +209,41 @@ namespace Guarneri
 					ss << "EarlyZ_Optimized_Pixels: " << Graphics().statistics.earlyz_optimized;
 					Window().draw_text(w, h, ss.str().c_str());
 				}
+				{
+					std::stringstream ss;
+					ss << "HiZ_Optimized_Tiles: " << Graphics().statistics.hiz_tile_optimized;
+					Window().draw_text(w, h, ss.str().c_str());
+				}
+				{
+					std::stringstream ss;
+					ss << "HiZ_Optimized_Blocks: " << Graphics().statistics.hiz_block_optimized;
+					Window().draw_text(w, h, ss.str().c_str());
+				}
+				{
+					std::stringstream ss;
+					ss << "TileBins: " << Graphics().statistics.binned_tile_count << ", OverlapRejectedTiles: " << Graphics().statistics.overlap_rejected_tile_count;
+					Window().draw_text(w, h, ss.str().c_str());
+				}
+				{
+					std::stringstream ss;
+					ss << "DepthPrepass: " << (misc_param.depth_prepass ? "ON" : "OFF") << ", DepthOnlyTriangles: " << Graphics().statistics.depth_only_triangle_count;
+					Window().draw_text(w, h, ss.str().c_str());
+				}
+				{
+					std::stringstream ss;
+					ss << "ShadedFragments: " << Graphics().statistics.shaded_fragment_count;
+					Window().draw_text(w, h, ss.str().c_str());
+				}
+				{
+					std::stringstream ss;
+					ss << "FastClearedTiles: " << Graphics().statistics.fast_cleared_tile_count;
+					Window().draw_text(w, h, ss.str().c_str());
+				}
+				{
+					std::stringstream ss;
+					ss << "TransientAllocations: " << Graphics().statistics.transient_allocation_count;
+					Window().draw_text(w, h, ss.str().c_str());
+				}
 				{
 					std::stringstream ss;
 					ss << "CameraPos: " << misc_param.camera_pos;
@@ -196,11 +254,16 @@ namespace Guarneri
 					ss << "LightDir: " << misc_param.main_light.forward;
 					Window().draw_text(w, h, ss.str().c_str());
 				}
+				{
+					std::stringstream ss;
+					ss << "SIMD: " << RasterKernel::str(RasterKernel::get_level());
+					Window().draw_text(w, h, ss.str().c_str());
+				}
 				if (Graphics().multi_thread)
 				{
 					{
 						std::stringstream ss;
-						ss << "Threads: " << std::thread::hardware_concurrency();
+						ss << "Threads: " << Graphics().get_job_system().worker_count() + 1;
 						Window().draw_text(w, h, ss.str().c_str());
 					}
 				}
@@ -209,7 +272,7 @@ namespace Guarneri
 					auto tinfo = Graphics().get_tile_info();
 					{
 						std::stringstream ss;
-						ss << "TileSize: " << tinfo.tile_size;
+						ss << "TileSize: " << tinfo.tile_width << "x" << tinfo.tile_height;
 						Window().draw_text(w, h, ss.str().c_str());
 					}
 					{
@@ -227,6 +290,49 @@ namespace Guarneri
 						ss << "TileTaskSize: " << tinfo.tile_task_size;
 						Window().draw_text(w, h, ss.str().c_str());
 					}
+					{
+						std::stringstream ss;
+						ss << "TileRegions: " << Graphics().statistics.tile_region_count << ", SplitTiles: " << Graphics().statistics.split_tile_count;
+						Window().draw_text(w, h, ss.str().c_str());
+					}
+					{
+						std::stringstream ss;
+						ss << "WorkerIdle: " << Graphics().statistics.worker_idle_time << "ms";
+						Window().draw_text(w, h, ss.str().c_str());
+					}
+					{
+						std::stringstream ss;
+						ss << "VisibilityBuffer: " << (Graphics().visibility_buffer ? "ON" : "OFF");
+						Window().draw_text(w, h, ss.str().c_str());
+					}
+					{
+						std::stringstream ss;
+						ss << "FramePipelining: " << (misc_param.frame_pipelining ? "ON" : "OFF");
+						Window().draw_text(w, h, ss.str().c_str());
+					}
+					{
+						std::stringstream ss;
+						ss << "Deterministic: " << (Graphics().deterministic ? "ON" : "OFF");
+						Window().draw_text(w, h, ss.str().c_str());
+					}
+					{
+						const char* policies[] = { "NONE", "COMPACT", "SCATTER" };
+						std::stringstream ss;
+						ss << "ThreadAffinity: " << policies[(int)misc_param.thread_affinity];
+						Window().draw_text(w, h, ss.str().c_str());
+					}
+					{
+						const char* layouts[] = { "LINEAR", "TILED", "MORTON" };
+						std::stringstream ss;
+						ss << "BufferLayout: " << layouts[(int)misc_param.buffer_layout];
+						Window().draw_text(w, h, ss.str().c_str());
+					}
+					{
+						const char* formats[] = { "D32F", "D24S8", "D16" };
+						std::stringstream ss;
+						ss << "DepthFormat: " << formats[(int)misc_param.depth_format] << ", ShadowFormat: " << formats[(int)misc_param.shadow_format];
+						Window().draw_text(w, h, ss.str().c_str());
+					}
 				}
 				Window().flush();
 				Time::frame_end();
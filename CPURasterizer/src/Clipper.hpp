@@ -7,84 +7,137 @@ namespace Guarneri
 	class Clipper
 	{
 	public:
-		static std::vector<Triangle> near_plane_clipping(const Plane& near_plane, const Vertex& v1, const Vertex& v2, const Vertex& v3);
-		static void screen_clipping(Vertex& lhs, Vertex& rhs, const int& width);
+		static size_t homogeneous_clipping(const Vertex& v1, const Vertex& v2, const Vertex& v3, const float& guard_band, const float& max_guard_band, Vertex* out);
+		static float max_guard_band(const uint32_t& width, const uint32_t& height);
 		static bool cvv_clipping(const Vector4& c1, const Vector4& c2, const Vector4& c3);
 		static bool cvv_clipping(const Vector4& v);
 		static bool backface_culling(const Vector4& v1, const Vector4& v2, const Vector4& v3);
 		static bool frustum_culling_sphere(const Frustum& frustum, const Sphere& bounding_sphere);
 		static bool conservative_frustum_culling(const Frustum& frustum, const Vertex& v1, const Vertex& v2, const Vertex& v3);
+
+	private:
+		static uint32_t outcode(const Vector4& p, const float& band);
+		static float plane_distance(const Vector4& p, const uint32_t& plane, const float& guard_band);
+		static Vertex interpolate(const Vertex& from, const Vertex& to, const float& t);
 	};
 
 
-	// near plane clipping
-	std::vector<Triangle> Clipper::near_plane_clipping(const Plane& near_plane, const Vertex& v1, const Vertex& v2, const Vertex& v3)
+	// a triangle is always clipped against the near plane, so no vertex with w <= 0 reaches the perspective divide,
+	// and only where it leaves the guard band against x, y = +-guard_band * w.
+	// bands below 1 are raised to 1, they would cut visible parts of the viewport, and bands above max_guard_band
+	// are lowered to it, a guard band of 0 clips only there.
+	// everything else inside the guard band is left to the rasterizer, which scissors to the viewport and tiles.
+	// the convex result is written to out (MAX_CLIP_VERTICES) and its vertex count returned, 0 means culled
+	size_t Clipper::homogeneous_clipping(const Vertex& v1, const Vertex& v2, const Vertex& v3, const float& guard_band, const float& max_guard_band, Vertex* out)
 	{
-		std::vector<Vertex> list_in = { v1, v2, v3 };
-
-		std::vector<Vertex> list_out;
-		for (size_t cur_idx = 0; cur_idx < list_in.size(); cur_idx++)
+		const Vertex* input[3] = { &v1, &v2, &v3 };
+		assert(max_guard_band >= 1.0f);
+		const float band = guard_band > 0.0f ? CLAMP_FLT(guard_band, 1.0f, max_guard_band) : max_guard_band;
+
+		// completely outside one frustum plane, x and y are culled at the real frustum not the guard band
+		uint32_t cull_and = ~0u;
+		uint32_t clip_or = 0;
+		for (int i = 0; i < 3; i++)
 		{
-			size_t last_idx = (cur_idx + list_in.size() - 1) % list_in.size();
-
-			Vertex cur = list_in[cur_idx];
-			Vertex last = list_in[last_idx];
+			cull_and &= outcode(input[i]->position, 1.0f);
+			clip_or |= outcode(input[i]->position, band);
+		}
+		if (cull_and != 0)
+		{
+			return 0;
+		}
 
-			float d1, d2;
-			d1 = near_plane.distance(cur.position.xyz());
-			d2 = near_plane.distance(last.position.xyz());
-			float t = d1 / (d1 - d2);
+		out[0] = v1;
+		out[1] = v2;
+		out[2] = v3;
+		if (clip_or == 0)
+		{
+			return 3;
+		}
 
-			// clip segment
-			if (d1 >= 0)
+		Vertex buffer[MAX_CLIP_VERTICES];
+		Vertex* src = out;
+		Vertex* dst = buffer;
+		size_t count = 3;
+		for (uint32_t plane = 0; plane < CLIP_PLANE_COUNT && count > 0; plane++)
+		{
+			if ((clip_or & (1u << plane)) == 0)
 			{
-				if (d2 < 0)
-				{
-					list_out.emplace_back(Vertex::interpolate(cur, last, t));
-				}
-				list_out.emplace_back(cur);
+				continue;
 			}
-			else if (d2 >= 0)
+			size_t out_count = 0;
+			for (size_t cur_idx = 0; cur_idx < count; cur_idx++)
 			{
-				list_out.emplace_back(Vertex::interpolate(cur, last, t));
+				const Vertex& cur = src[cur_idx];
+				const Vertex& next = src[(cur_idx + 1) % count];
+				float d1 = plane_distance(cur.position, plane, band);
+				float d2 = plane_distance(next.position, plane, band);
+				if (d1 >= 0.0f)
+				{
+					dst[out_count++] = cur;
+				}
+				if ((d1 >= 0.0f) != (d2 >= 0.0f))
+				{
+					dst[out_count++] = interpolate(cur, next, d1 / (d1 - d2));
+				}
 			}
+			count = out_count;
+			std::swap(src, dst);
 		}
 
-		assert((list_out.size() == 0 || list_out.size() == 3 || list_out.size() == 4));
-
-		std::vector<Triangle> triangles;
-
-		if (list_out.size() == 3)
-		{
-			triangles.emplace_back(Triangle(list_out[0], list_out[1], list_out[2]));
-		}
-		else if (list_out.size() == 4)
-		{
-			triangles.emplace_back(Triangle(list_out[0], list_out[1], list_out[2]));
-			triangles.emplace_back(Triangle(list_out[2], list_out[3], list_out[0]));
-		}
-		else if (list_out.size() != 0)
+		if (src != out)
 		{
-			std::cerr << "clipping error, size of vertices: " << list_out.size() << std::endl;
+			std::copy(src, src + count, out);
 		}
+		return count < 3 ? 0 : count;
+	}
 
-		return triangles;
+	// largest band whose screen positions stay inside the fixed point range of the rasterizer, a vertex clamped
+	// there on its own would move and bend its edges. the band reaches (band + 1) / 2 viewports from the origin
+	float Clipper::max_guard_band(const uint32_t& width, const uint32_t& height)
+	{
+		float extent = (float)std::max(std::max(width, height), 1u);
+		return std::max(2.0f * (SUBPIXEL_MAX_COORD - 1.0f) / extent - 1.0f, 1.0f);
 	}
 
-	void Clipper::screen_clipping(Vertex& lhs, Vertex& rhs, const int& width)
+	// bit per clip plane the position lies behind, x and y planes are scaled by the band
+	uint32_t Clipper::outcode(const Vector4& p, const float& band)
 	{
-		if (lhs.position.x <= 0.0f)
-		{
-			float t = -lhs.position.x / (rhs.position.x - lhs.position.x);
-			lhs = Vertex::interpolate(lhs, rhs, t);
-		}
-		if (rhs.position.x >= width)
+		uint32_t code = 0;
+		if (p.z < -p.w) code |= NEAR_CLIP_BIT;
+		if (p.x < -band * p.w) code |= 1u << 1;
+		if (p.x > band * p.w) code |= 1u << 2;
+		if (p.y < -band * p.w) code |= 1u << 3;
+		if (p.y > band * p.w) code |= 1u << 4;
+		return code;
+	}
+
+	// signed distance to a clip plane, inside is positive
+	float Clipper::plane_distance(const Vector4& p, const uint32_t& plane, const float& guard_band)
+	{
+		switch (plane)
 		{
-			float t = ((float)width - lhs.position.x) / (rhs.position.x - lhs.position.x);
-			rhs = Vertex::interpolate(lhs, rhs, t);
+		case 0:
+			return p.z + p.w;
+		case 1:
+			return p.x + guard_band * p.w;
+		case 2:
+			return guard_band * p.w - p.x;
+		case 3:
+			return p.y + guard_band * p.w;
+		default:
+			return guard_band * p.w - p.y;
 		}
 	}
 
+	// attributes are still linear in clip space, only rhw has to be rebuilt
+	Vertex Clipper::interpolate(const Vertex& from, const Vertex& to, const float& t)
+	{
+		Vertex ret = Vertex::interpolate(from, to, t);
+		ret.rhw = 1.0f / ret.position.w;
+		return ret;
+	}
+
 	bool Clipper::cvv_clipping(const Vector4& c1, const Vector4& c2, const Vector4& c3)
 	{
 		// z: [-w, w](GL) [0, w](DX)
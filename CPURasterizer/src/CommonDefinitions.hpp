@@ -103,6 +103,30 @@ namespace Guarneri
 		uint32_t culled_triangle_count;
 		uint32_t culled_backface_triangle_count;
 		uint32_t earlyz_optimized;
+		uint32_t hiz_tile_optimized;
+		uint32_t hiz_block_optimized;
+		// tile bin entries, and bounding box tiles the triangle does not overlap which
+		// plain bounding box binning would have added as false positives
+		uint32_t binned_tile_count;
+		uint32_t overlap_rejected_tile_count;
+		// tile work items after splitting, and time threads spent waiting for others to finish their tiles in ms
+		uint32_t tile_region_count;
+		uint32_t split_tile_count;
+		float worker_idle_time;
+		uint32_t depth_only_triangle_count;
+		uint32_t shaded_fragment_count;
+		// tiles no triangle touched whose recorded clear was applied with streaming stores
+		uint32_t fast_cleared_tile_count;
+		// heap allocations of the transient draw path since startup, flat once warmed up
+		uint32_t transient_allocation_count;
+	};
+
+	// counters of one thread, padded so no two threads write the same cache line
+	struct alignas(64) ThreadStatistic
+	{
+		GraphicsStatistic counters;
+
+		ThreadStatistic() : counters() {}
 	};
 
 	// pixel block
@@ -0,0 +1,389 @@
+#ifndef _DEPTH_STENCIL_BUFFER_
+#define _DEPTH_STENCIL_BUFFER_
+#include <CPURasterizer.hpp>
+
+// largest value of the unorm depth formats
+#define D16_MAX 0xFFFFu
+#define D24_MAX 0xFFFFFFu
+
+namespace Guarneri
+{
+	// storage of a depth target, unorm formats hold depth in [0, 1]
+	enum class DepthFormat
+	{
+		// 32 bits float depth, stencil in a separate plane
+		D32F,
+		// 24 bits unorm depth and 8 bits stencil packed in one word, depth in the high bits
+		D24S8,
+		// 16 bits unorm depth, stencil in a separate plane
+		D16
+	};
+
+
+	struct DepthStencilSample
+	{
+		float depth;
+		uint8_t stencil;
+	};
+
+
+	// depth target of any DepthFormat with optional stencil, a target without stencil reads DEFAULT_STENCIL and drops stencil writes.
+	// unorm depth is rounded towards FAR_Z, so a stored depth is never nearer than the depth written,
+	// and fragments are compared with the decoded depth exactly like the span kernel does
+	class DepthStencilBuffer
+	{
+	public:
+		uint32_t width;
+		uint32_t height;
+		DepthFormat format;
+
+	private:
+		std::unique_ptr<RawBuffer<float>> depth32;
+		std::unique_ptr<RawBuffer<uint32_t>> packed;
+		std::unique_ptr<RawBuffer<uint16_t>> depth16;
+		std::unique_ptr<RawBuffer<uint8_t>> stencil8;
+
+	public:
+		DepthStencilBuffer(uint32_t _width, uint32_t _height, DepthFormat _format, BufferLayout _layout, bool _stencil);
+		bool read(const float& u, const float& v, float& depth) const;
+		bool read(const uint32_t& row, const uint32_t& col, float& depth) const;
+		bool read(const uint32_t& row, const uint32_t& col, DepthStencilSample& sample) const;
+		bool read_stencil(const uint32_t& row, const uint32_t& col, uint8_t& stencil) const;
+		bool write(const uint32_t& row, const uint32_t& col, const float& depth);
+		bool write(const uint32_t& row, const uint32_t& col, const DepthStencilSample& sample);
+		DepthStencilSample load(const uint32_t& row, const uint32_t& col) const;
+		float load_depth(const uint32_t& row, const uint32_t& col) const;
+		void store(const uint32_t& row, const uint32_t& col, const DepthStencilSample& sample);
+		void store(const uint32_t& row, const uint32_t& col, const float& depth);
+		void store_stencil(const uint32_t& row, const uint32_t& col, const uint8_t& stencil);
+		void clear(const BufferFlag& flag, const float& depth, const uint8_t& stencil, const uint32_t& row_start, const uint32_t& row_end, const uint32_t& col_start, const uint32_t& col_end, const bool& streaming);
+		float* get_ptr(const uint32_t& row, const uint32_t& col);
+		uint32_t span_length(const uint32_t& row, const uint32_t& col) const;
+		size_t bytes_per_pixel() const;
+
+	private:
+		static uint32_t encode(const float& depth, const uint32_t& max);
+		static float decode(const uint32_t& value, const uint32_t& max);
+	};
+
+
+	DepthStencilBuffer::DepthStencilBuffer(uint32_t _width, uint32_t _height, DepthFormat _format, BufferLayout _layout, bool _stencil)
+	{
+		this->width = _width;
+		this->height = _height;
+		this->format = _format;
+		switch (_format)
+		{
+		case DepthFormat::D32F:
+			depth32 = std::make_unique<RawBuffer<float>>(_width, _height, _layout);
+			break;
+		case DepthFormat::D24S8:
+			packed = std::make_unique<RawBuffer<uint32_t>>(_width, _height, _layout);
+			break;
+		case DepthFormat::D16:
+			depth16 = std::make_unique<RawBuffer<uint16_t>>(_width, _height, _layout);
+			break;
+		}
+		if (_stencil && _format != DepthFormat::D24S8)
+		{
+			stencil8 = std::make_unique<RawBuffer<uint8_t>>(_width, _height, _layout);
+		}
+	}
+
+	bool DepthStencilBuffer::read(const float& u, const float& v, float& depth) const
+	{
+		// every plane has the same size
+		uint32_t row, col;
+		if (depth32 != nullptr)
+		{
+			depth32->uv2pixel(u, v, row, col);
+		}
+		else if (packed != nullptr)
+		{
+			packed->uv2pixel(u, v, row, col);
+		}
+		else
+		{
+			depth16->uv2pixel(u, v, row, col);
+		}
+		return read(row, col, depth);
+	}
+
+	bool DepthStencilBuffer::read(const uint32_t& row, const uint32_t& col, float& depth) const
+	{
+		switch (format)
+		{
+		case DepthFormat::D32F:
+			return depth32->read(row, col, depth);
+		case DepthFormat::D24S8:
+		{
+			uint32_t value;
+			if (!packed->read(row, col, value))
+			{
+				return false;
+			}
+			depth = decode(value >> 8, D24_MAX);
+			return true;
+		}
+		default:
+		{
+			uint16_t value;
+			if (!depth16->read(row, col, value))
+			{
+				return false;
+			}
+			depth = decode(value, D16_MAX);
+			return true;
+		}
+		}
+	}
+
+	// depth and stencil of a packed format come from a single load
+	bool DepthStencilBuffer::read(const uint32_t& row, const uint32_t& col, DepthStencilSample& sample) const
+	{
+		if (format == DepthFormat::D24S8)
+		{
+			uint32_t value;
+			if (!packed->read(row, col, value))
+			{
+				return false;
+			}
+			sample.depth = decode(value >> 8, D24_MAX);
+			sample.stencil = (uint8_t)(value & 0xFF);
+			return true;
+		}
+		return read(row, col, sample.depth) && read_stencil(row, col, sample.stencil);
+	}
+
+	bool DepthStencilBuffer::read_stencil(const uint32_t& row, const uint32_t& col, uint8_t& stencil) const
+	{
+		if (format == DepthFormat::D24S8)
+		{
+			uint32_t value;
+			if (!packed->read(row, col, value))
+			{
+				return false;
+			}
+			stencil = (uint8_t)(value & 0xFF);
+			return true;
+		}
+		if (stencil8 == nullptr)
+		{
+			if (row >= height || col >= width)
+			{
+				return false;
+			}
+			stencil = DEFAULT_STENCIL;
+			return true;
+		}
+		return stencil8->read(row, col, stencil);
+	}
+
+	// the stencil of a packed format is kept
+	bool DepthStencilBuffer::write(const uint32_t& row, const uint32_t& col, const float& depth)
+	{
+		switch (format)
+		{
+		case DepthFormat::D32F:
+			return depth32->write(row, col, depth);
+		case DepthFormat::D24S8:
+		{
+			uint32_t value;
+			if (!packed->read(row, col, value))
+			{
+				return false;
+			}
+			return packed->write(row, col, (encode(depth, D24_MAX) << 8) | (value & 0xFF));
+		}
+		default:
+			return depth16->write(row, col, (uint16_t)encode(depth, D16_MAX));
+		}
+	}
+
+	bool DepthStencilBuffer::write(const uint32_t& row, const uint32_t& col, const DepthStencilSample& sample)
+	{
+		if (format == DepthFormat::D24S8)
+		{
+			return packed->write(row, col, (encode(sample.depth, D24_MAX) << 8) | sample.stencil);
+		}
+		if (stencil8 != nullptr)
+		{
+			stencil8->write(row, col, sample.stencil);
+		}
+		return write(row, col, sample.depth);
+	}
+
+	// unchecked read and write of the per fragment path, the caller keeps row and col inside the target
+	DepthStencilSample DepthStencilBuffer::load(const uint32_t& row, const uint32_t& col) const
+	{
+		DepthStencilSample sample;
+		switch (format)
+		{
+		case DepthFormat::D32F:
+			sample.depth = depth32->at(row, col);
+			break;
+		case DepthFormat::D24S8:
+		{
+			uint32_t value = packed->at(row, col);
+			sample.depth = decode(value >> 8, D24_MAX);
+			sample.stencil = (uint8_t)(value & 0xFF);
+			return sample;
+		}
+		default:
+			sample.depth = decode(depth16->at(row, col), D16_MAX);
+			break;
+		}
+		sample.stencil = stencil8 != nullptr ? stencil8->at(row, col) : (uint8_t)DEFAULT_STENCIL;
+		return sample;
+	}
+
+	float DepthStencilBuffer::load_depth(const uint32_t& row, const uint32_t& col) const
+	{
+		switch (format)
+		{
+		case DepthFormat::D32F:
+			return depth32->at(row, col);
+		case DepthFormat::D24S8:
+			return decode(packed->at(row, col) >> 8, D24_MAX);
+		default:
+			return decode(depth16->at(row, col), D16_MAX);
+		}
+	}
+
+	void DepthStencilBuffer::store(const uint32_t& row, const uint32_t& col, const DepthStencilSample& sample)
+	{
+		if (format == DepthFormat::D24S8)
+		{
+			packed->at(row, col) = (encode(sample.depth, D24_MAX) << 8) | sample.stencil;
+			return;
+		}
+		if (stencil8 != nullptr)
+		{
+			stencil8->at(row, col) = sample.stencil;
+		}
+		store(row, col, sample.depth);
+	}
+
+	void DepthStencilBuffer::store(const uint32_t& row, const uint32_t& col, const float& depth)
+	{
+		switch (format)
+		{
+		case DepthFormat::D32F:
+			depth32->at(row, col) = depth;
+			break;
+		case DepthFormat::D24S8:
+		{
+			uint32_t& value = packed->at(row, col);
+			value = (encode(depth, D24_MAX) << 8) | (value & 0xFF);
+			break;
+		}
+		default:
+			depth16->at(row, col) = (uint16_t)encode(depth, D16_MAX);
+			break;
+		}
+	}
+
+	// keeps the stored depth bits, re-encoding a decoded unorm depth would move it one step towards FAR_Z
+	void DepthStencilBuffer::store_stencil(const uint32_t& row, const uint32_t& col, const uint8_t& stencil)
+	{
+		if (format == DepthFormat::D24S8)
+		{
+			uint32_t& value = packed->at(row, col);
+			value = (value & ~0xFFu) | stencil;
+			return;
+		}
+		if (stencil8 != nullptr)
+		{
+			stencil8->at(row, col) = stencil;
+		}
+	}
+
+	// the DEPTH and STENCIL parts of flag over a rectangle, only a packed format clearing just one of them reads the target
+	void DepthStencilBuffer::clear(const BufferFlag& flag, const float& depth, const uint8_t& stencil, const uint32_t& row_start, const uint32_t& row_end, const uint32_t& col_start, const uint32_t& col_end, const bool& streaming)
+	{
+		bool clear_depth = (flag & BufferFlag::DEPTH) != BufferFlag::NONE;
+		bool clear_stencil = (flag & BufferFlag::STENCIL) != BufferFlag::NONE;
+		if (format == DepthFormat::D24S8)
+		{
+			uint32_t value = (encode(depth, D24_MAX) << 8) | stencil;
+			if (clear_depth && clear_stencil)
+			{
+				packed->clear(value, row_start, row_end, col_start, col_end, streaming);
+				return;
+			}
+			if (!clear_depth && !clear_stencil)
+			{
+				return;
+			}
+			uint32_t mask = clear_depth ? 0xFFFFFF00u : 0xFFu;
+			uint32_t rend = std::min(row_end, height);
+			uint32_t cend = std::min(col_end, width);
+			for (uint32_t row = row_start; row < rend; row++)
+			{
+				for (uint32_t col = col_start; col < cend;)
+				{
+					uint32_t count = std::min(packed->span_length(row, col), cend - col);
+					uint32_t* ptr = packed->get_ptr(row, col);
+					for (uint32_t idx = 0; idx < count; idx++)
+					{
+						ptr[idx] = (ptr[idx] & ~mask) | (value & mask);
+					}
+					col += count;
+				}
+			}
+			return;
+		}
+		if (clear_depth && depth32 != nullptr)
+		{
+			depth32->clear(depth, row_start, row_end, col_start, col_end, streaming);
+		}
+		if (clear_depth && depth16 != nullptr)
+		{
+			depth16->clear((uint16_t)encode(depth, D16_MAX), row_start, row_end, col_start, col_end, streaming);
+		}
+		if (clear_stencil && stencil8 != nullptr)
+		{
+			stencil8->clear(stencil, row_start, row_end, col_start, col_end, streaming);
+		}
+	}
+
+	// float depth addressable in place, nullptr for the unorm formats
+	float* DepthStencilBuffer::get_ptr(const uint32_t& row, const uint32_t& col)
+	{
+		return depth32 != nullptr ? depth32->get_ptr(row, col) : nullptr;
+	}
+
+	// pixels of the row that get_ptr exposes consecutively, 0 for the unorm formats
+	uint32_t DepthStencilBuffer::span_length(const uint32_t& row, const uint32_t& col) const
+	{
+		return depth32 != nullptr ? depth32->span_length(row, col) : 0;
+	}
+
+	size_t DepthStencilBuffer::bytes_per_pixel() const
+	{
+		size_t stencil_size = stencil8 != nullptr ? sizeof(uint8_t) : 0;
+		switch (format)
+		{
+		case DepthFormat::D32F:
+			return sizeof(float) + stencil_size;
+		case DepthFormat::D24S8:
+			return sizeof(uint32_t);
+		default:
+			return sizeof(uint16_t) + stencil_size;
+		}
+	}
+
+	// rounds up, the product of a float and a 24 bits integer is exact in double
+	uint32_t DepthStencilBuffer::encode(const float& depth, const uint32_t& max)
+	{
+		double value = std::ceil((double)CLAMP_FLT(depth, 0.0f, 1.0f) * max);
+		return (uint32_t)value;
+	}
+
+	// division is correctly rounded, so decode(encode(depth)) >= depth
+	float DepthStencilBuffer::decode(const uint32_t& value, const uint32_t& max)
+	{
+		return (float)((double)value / max);
+	}
+}
+#endif
@@ -5,7 +5,8 @@ namespace Guarneri
 {
 	typedef struct
 	{
-		uint32_t tile_size;
+		uint32_t tile_width;
+		uint32_t tile_height;
 		uint32_t tile_task_size;
 		uint32_t row_tile_count;
 		uint32_t col_tile_count;
@@ -13,15 +14,112 @@ namespace Guarneri
 	} TileInfo;
 
 
-	struct TileTask
+	// what the visibility pass stores per pixel, shading is deferred until the tile is resolved
+	struct VisibilitySample
 	{
-	public:
-		Triangle triangle;
+		uint32_t triangle_id;
+		float w1;
+		float w2;
+	};
+
+
+	// per triangle outcome of binning, tiles of the bounding box end up in exactly one count
+	struct BinningStatistic
+	{
+		uint32_t binned;
+		uint32_t occluded;
+		// bounding box tiles without a single covered sample
+		uint32_t rejected;
+	};
+
+
+	// part of a tile rendered by one job, oversized tiles are split into row bands
+	struct TileRegion
+	{
+		uint32_t tile_idx;
+		uint32_t row_start;
+		uint32_t row_end;
+		uint32_t col_start;
+		uint32_t col_end;
+		uint64_t cost;
+		// recorded clears the region applies to its pixels before rasterizing
+		BufferFlag clear_flag;
+	};
+
+
+	// everything tiles need of a triangle, set up once per frame and referenced by index from the bins
+	struct BinnedTriangle
+	{
+		TriangleSetup setup;
 		Shader* shader;
+		// submission order, tiles execute their triangles sorted by it
+		uint64_t sequence;
+		// rasterized into the visibility buffer with its index as id
+		bool deferred;
+		// screen positions for the wireframe and culled face views
+		bool culled;
+		Vector4 positions[3];
+	};
+
+
+	// private bins of one submitting thread, nothing here is shared until the tiles are merged.
+	// the triangles of all binners form one frame-wide index space, binner_idx << BINNED_TRIANGLE_BITS | local index
+	class TileBinner
+	{
+	public:
+		uint32_t binner_idx;
+		std::vector<BinnedTriangle> triangles;
+		// one bin of local triangle indices per tile, in the order this thread submitted
+		std::vector<std::vector<uint32_t>> bins;
+		// cleared when the thread went back in sequence, bins are then sorted before merging
+		bool ordered;
+		uint64_t last_sequence;
+		size_t allocations;
 
 	public:
-		TileTask();
-		TileTask(const Triangle& triangle, Shader* shader);
+		TileBinner(const uint32_t& binner_idx, const size_t& tile_length);
+		bool full() const;
+		BinnedTriangle& push_triangle();
+		uint32_t triangle_index(const size_t& local) const;
+		void push_task(const int& tile_idx, const uint32_t& local);
+		void resize(const size_t& tile_length);
+		void reset();
+	};
+
+
+	// screen space segment issued while the targets still belonged to a frame in flight
+	struct ScreenSegment
+	{
+		int x0;
+		int y0;
+		int x1;
+		int y1;
+		color_bgra color;
+	};
+
+
+	// everything one submitted frame needs until its tiles are rendered, frames alternate between two of these
+	// so the next frame can be recorded while the previous one is rasterized
+	struct FrameContext
+	{
+	public:
+		// per thread triangle records and bins, recycled once the tiles are rendered
+		std::vector<std::unique_ptr<TileBinner>> binners;
+		size_t binners_in_use;
+		// shader state and misc_param as they were when the frame was recorded
+		std::vector<std::unique_ptr<Shader>> shaders;
+		MiscParameter params;
+		// a shader could not be copied, the frame is then rendered before present() returns
+		bool shared_shaders;
+		// clears and segments issued while the previous frame was still rendering, clear_segment segments come before the clear
+		BufferFlag pending_clear;
+		size_t clear_segment;
+		std::vector<ScreenSegment> segments;
+		// reached once the tiles of a pipelined frame are rendered
+		JobCounter fence;
+
+	public:
+		FrameContext();
 	};
 
 
@@ -33,42 +131,108 @@ namespace Guarneri
 		uint32_t row_end;
 		uint32_t col_start;
 		uint32_t col_end;
-		SafeQueue<TileTask> tasks;
+		// conservative farthest depth in the tile, refreshed whenever the tile is rasterized
+		float max_z;
+		// estimated work of the merged tasks in pixels, see GraphicsDevice::prepare_tile
+		uint64_t cost;
+		// worker rendering the tile before any other, stable across frames
+		uint32_t owner;
+		// clears recorded since the tile was last rendered, see GraphicsDevice::apply_clear
+		BufferFlag clear_flag;
+		// frame-wide triangle indices of every binner merged in submission order, capacity is kept across frames
+		std::vector<uint32_t> tasks;
+		size_t task_allocations;
 
 	public:
 		FrameTile();
 		~FrameTile();
-		void push_task(const Triangle& tri, Shader* shader);
-		bool pop_task(TileTask& task);
+		void merge_tasks(std::vector<std::unique_ptr<TileBinner>>& binners, const size_t& binner_count);
 		bool is_task_empty();
 		void clear();
 		size_t task_size();
 		static int coord2index(const int& row, const int& col, const int& col_tile_count);
-		static void pixel2tile(const int& prow, const int& pcol, int& trow, int& tcol, const int& tile_size);
+		static void pixel2tile(const int& prow, const int& pcol, int& trow, int& tcol, const int& tile_width, const int& tile_height);
 		static void build_tiles(
 			FrameTile* tiles,
-			const int& tile_size,
+			const int& tile_width, const int& tile_height,
 			const int& row_tile_count, const int& col_tile_count,
 			const int& row_rest, const int& col_rest);
-		static void dispatch_render_task(
-			FrameTile* tiles,
-			const Triangle& tri,
-			Shader* shader,
+		static BinningStatistic dispatch_render_task(
+			const FrameTile* tiles,
+			TileBinner& binner,
+			const uint32_t& local,
+			const bool& overlap_test,
+			const bool& hiz_test,
 			const int& w, const int& h,
-			const int& tile_size,
+			const int& tile_width, const int& tile_height,
 			const int& col_tile_count);
 	};
 
 
-	TileTask::TileTask()
+	TileBinner::TileBinner(const uint32_t& binner_idx, const size_t& tile_length) : bins(tile_length)
+	{
+		this->binner_idx = binner_idx;
+		ordered = true;
+		last_sequence = 0;
+		allocations = 0;
+	}
+
+	// local indices have BINNED_TRIANGLE_BITS, a full binner is replaced by a fresh one, see GraphicsDevice::thread_binner
+	bool TileBinner::full() const
+	{
+		return triangles.size() >= BINNED_TRIANGLE_MASK;
+	}
+
+	// the record is only valid until the next push, bins refer to it by index
+	BinnedTriangle& TileBinner::push_triangle()
+	{
+		assert(triangles.size() < BINNED_TRIANGLE_MASK);
+		if (triangles.size() == triangles.capacity())
+		{
+			allocations++;
+		}
+		triangles.emplace_back();
+		return triangles.back();
+	}
+
+	uint32_t TileBinner::triangle_index(const size_t& local) const
+	{
+		assert(binner_idx < MAX_TILE_BINNERS);
+		return (binner_idx << BINNED_TRIANGLE_BITS) | (uint32_t)local;
+	}
+
+	void TileBinner::push_task(const int& tile_idx, const uint32_t& local)
 	{
-		shader = nullptr;
+		std::vector<uint32_t>& bin = bins[tile_idx];
+		if (bin.size() == bin.capacity())
+		{
+			allocations++;
+		}
+		bin.push_back(local);
+	}
+
+	void TileBinner::resize(const size_t& tile_length)
+	{
+		bins.resize(tile_length);
+	}
+
+	void TileBinner::reset()
+	{
+		for (auto& bin : bins)
+		{
+			bin.clear();
+		}
+		triangles.clear();
+		ordered = true;
+		last_sequence = 0;
 	}
 
-	TileTask::TileTask(const Triangle& triangle, Shader* shader)
+	FrameContext::FrameContext()
 	{
-		this->triangle = triangle;
-		this->shader = shader;
+		binners_in_use = 0;
+		shared_shaders = false;
+		pending_clear = BufferFlag::NONE;
+		clear_segment = 0;
 	}
 
 	FrameTile::FrameTile()
@@ -78,6 +242,11 @@ namespace Guarneri
 		row_end = 0;
 		col_start = 0;
 		col_end = 0;
+		max_z = FAR_Z;
+		cost = 0;
+		owner = 0;
+		clear_flag = BufferFlag::NONE;
+		task_allocations = 0;
 	}
 
 	FrameTile::~FrameTile()
@@ -85,14 +254,51 @@ namespace Guarneri
 
 	}
 
-	void FrameTile::push_task(const Triangle& tri, Shader* shader)
+	// k-way merge of the binners' bins for this tile, sequences are unique so the order is total
+	void FrameTile::merge_tasks(std::vector<std::unique_ptr<TileBinner>>& binners, const size_t& binner_count)
 	{
-		tasks.produce(TileTask(tri, shader));
-	}
+		assert(binner_count <= MAX_TILE_BINNERS);
+		size_t cursors[MAX_TILE_BINNERS];
+		size_t total = 0;
+		for (size_t bidx = 0; bidx < binner_count; bidx++)
+		{
+			const std::vector<BinnedTriangle>& triangles = binners[bidx]->triangles;
+			std::vector<uint32_t>& bin = binners[bidx]->bins[tile_idx];
+			if (!binners[bidx]->ordered)
+			{
+				std::sort(bin.begin(), bin.end(), [&triangles](const uint32_t& lhs, const uint32_t& rhs)
+				{
+					return triangles[lhs].sequence < triangles[rhs].sequence;
+				});
+			}
+			cursors[bidx] = 0;
+			total += bin.size();
+		}
+		if (total > tasks.capacity())
+		{
+			task_allocations++;
+		}
+		tasks.reserve(total);
 
-	bool FrameTile::pop_task(TileTask& task)
-	{
-		return tasks.try_consume(task);
+		while (tasks.size() < total)
+		{
+			size_t next = binner_count;
+			uint64_t next_sequence = 0;
+			for (size_t bidx = 0; bidx < binner_count; bidx++)
+			{
+				const std::vector<uint32_t>& bin = binners[bidx]->bins[tile_idx];
+				if (cursors[bidx] < bin.size())
+				{
+					uint64_t sequence = binners[bidx]->triangles[bin[cursors[bidx]]].sequence;
+					if (next == binner_count || sequence < next_sequence)
+					{
+						next = bidx;
+						next_sequence = sequence;
+					}
+				}
+			}
+			tasks.push_back(binners[next]->triangle_index(binners[next]->bins[tile_idx][cursors[next]++]));
+		}
 	}
 
 	bool FrameTile::is_task_empty()
@@ -100,6 +306,7 @@ namespace Guarneri
 		return tasks.empty();
 	}
 
+	// keeps the capacity for the next frame
 	void FrameTile::clear()
 	{
 		tasks.clear();
@@ -121,16 +328,16 @@ namespace Guarneri
 	void FrameTile::pixel2tile(
 		const int& prow, const int& pcol,
 		int& trow, int& tcol,
-		const int& tile_size)
+		const int& tile_width, const int& tile_height)
 	{
-		assert(tile_size != 0);
-		trow = prow / tile_size;
-		tcol = pcol / tile_size;
+		assert(tile_width != 0 && tile_height != 0);
+		trow = prow / tile_height;
+		tcol = pcol / tile_width;
 	}
 
 	void FrameTile::build_tiles(
 		FrameTile* tiles,
-		const int& tile_size,
+		const int& tile_width, const int& tile_height,
 		const int& row_tile_count, const int& col_tile_count,
 		const int& row_rest, const int& col_rest)
 	{
@@ -140,54 +347,91 @@ namespace Guarneri
 			{
 				bool last = false;
 				int tidx = coord2index(row, col, col_tile_count);
-				int rs = row * tile_size;
+				int rs = row * tile_height;
 				tiles[tidx].row_start = rs;
 				last = row == row_tile_count - 1 ? true : false;
-				tiles[tidx].row_end = last && row_rest > 0 ? rs + row_rest : (row + 1) * tile_size;
+				tiles[tidx].row_end = last && row_rest > 0 ? rs + row_rest : (row + 1) * tile_height;
 
-				int cs = col * tile_size;
+				int cs = col * tile_width;
 				tiles[tidx].col_start = cs;
 				last = col == col_tile_count - 1 ? true : false;
-				tiles[tidx].col_end = last && col_rest > 0 ? cs + col_rest : (col + 1) * tile_size;
+				tiles[tidx].col_end = last && col_rest > 0 ? cs + col_rest : (col + 1) * tile_width;
 
 				tiles[tidx].tile_idx = tidx;
 			}
 		}
 	}
 
-	void FrameTile::dispatch_render_task(
-		FrameTile* tiles,
-		const Triangle& tri,
-		Shader* shader,
+	// bins the triangle into the tiles of its bounding box that it really overlaps and that are not occluded
+	BinningStatistic FrameTile::dispatch_render_task(
+		const FrameTile* tiles,
+		TileBinner& binner,
+		const uint32_t& local,
+		const bool& overlap_test,
+		const bool& hiz_test,
 		const int& w, const int& h,
-		const int& tile_size,
+		const int& tile_width, const int& tile_height,
 		const int& col_tile_count)
 	{
-		auto bounds = BoundingBox2D(tri[0].position, tri[1].position, tri[2].position);
-		int row_start = (int)(bounds.min().y + 0.5f) - 1;
-		int row_end = (int)(bounds.max().y + 0.5f) + 1;
-		int col_start = (int)(bounds.min().x + 0.5f) - 1;
-		int col_end = (int)(bounds.max().x + 0.5f) + 1;
+		const BinnedTriangle& binned = binner.triangles[local];
+		const TriangleSetup* setup = &binned.setup;
+		const uint64_t& sequence = binned.sequence;
 
-		row_start = CLAMP_INT(row_start, 0, h);
-		row_end = CLAMP_INT(row_end, 0, h);
-		col_start = CLAMP_INT(col_start, 0, w);
-		col_end = CLAMP_INT(col_end, 0, w);
+		// setup bounds are exact pixel ranges (end exclusive)
+		int row_start = CLAMP_INT(setup->row_start, 0, h);
+		int row_end = CLAMP_INT(setup->row_end, 0, h);
+		int col_start = CLAMP_INT(setup->col_start, 0, w);
+		int col_end = CLAMP_INT(setup->col_end, 0, w);
+
+		BinningStatistic result = { 0, 0, 0 };
+		if (row_start >= row_end || col_start >= col_end)
+		{
+			return result;
+		}
 
 		int tile_row_start, tile_row_end;
 		int tile_col_start, tile_col_end;
 
-		pixel2tile(row_start, col_start, tile_row_start, tile_col_start, tile_size);
-		pixel2tile(row_end, col_end, tile_row_end, tile_col_end, tile_size);
+		pixel2tile(row_start, col_start, tile_row_start, tile_col_start, tile_width, tile_height);
+		pixel2tile(row_end - 1, col_end - 1, tile_row_end, tile_col_end, tile_width, tile_height);
+
+		if (sequence < binner.last_sequence)
+		{
+			binner.ordered = false;
+		}
+		binner.last_sequence = sequence;
 
+		// a single tile is the bounding box itself, nothing to reject
+		bool multi_tile = tile_row_start != tile_row_end || tile_col_start != tile_col_end;
 		for (int row = tile_row_start; row <= tile_row_end; row++)
 		{
 			for (int col = tile_col_start; col <= tile_col_end; col++)
 			{
 				int tile_idx = coord2index(row, col, col_tile_count);
-				tiles[tile_idx].push_task(tri, shader);
+				const FrameTile& tile = tiles[tile_idx];
+				// edge functions at the corners of the part of the bounding box inside the tile
+				if (overlap_test && multi_tile)
+				{
+					int rs = std::max(row_start, (int)tile.row_start);
+					int re = std::min(row_end, (int)tile.row_end);
+					int cs = std::max(col_start, (int)tile.col_start);
+					int ce = std::min(col_end, (int)tile.col_end);
+					if (setup->classify_block(rs, re, cs, ce) == BlockCoverage::OUTSIDE)
+					{
+						result.rejected++;
+						continue;
+					}
+				}
+				if (hiz_test && setup->min_z - HIZ_EPSILON > tile.max_z)
+				{
+					result.occluded++;
+					continue;
+				}
+				binner.push_task(tile_idx, local);
+				result.binned++;
 			}
 		}
+		return result;
 	}
 }
 #endif
\ No newline at end of file
@@ -12,33 +12,101 @@ namespace Guarneri
 		GraphicsStatistic statistics;
 		bool tile_based;
 		bool multi_thread;
+		// rasterize opaque geometry into the visibility buffer and shade each pixel once per tile
+		bool visibility_buffer;
+		// bit-identical framebuffers for any thread count, draws that bypass the tiles are then submitted serially
+		bool deterministic;
 
 	private:
-		// use 32 bits zbuffer here, for convenience 
-		std::unique_ptr<RawBuffer<float>> zbuffer;
+		// depth and 8 bits stencil in depth_format
+		std::unique_ptr<DepthStencilBuffer> zbuffer;
 		// 32 bits bgra framebuffer, 8-bit per channel
 		std::unique_ptr<RawBuffer<color_bgra>> framebuffer;
-		// 8 bits stencil buffer
-		std::unique_ptr<RawBuffer<uint8_t>> stencilbuffer;
-		// shadowmap
-		std::unique_ptr<RawBuffer<float>> shadowmap;
-		// framebuffer tiles
-		const uint32_t TILE_SIZE = 256;
-		const uint32_t TILE_TASK_SIZE = 1;
+		// shadowmap, depth only in shadow_format
+		std::unique_ptr<DepthStencilBuffer> shadowmap;
+		// guard band limit of the viewport, see Clipper::max_guard_band
+		float max_guard_band;
+		// farthest depth of every HIZ_BLOCK_SIZE x HIZ_BLOCK_SIZE block of zbuffer
+		std::unique_ptr<RawBuffer<float>> hizbuffer;
+		// triangle id and barycentrics of the nearest deferred surface
+		std::unique_ptr<RawBuffer<VisibilitySample>> visibilitybuffer;
+		// the frame being recorded and the frame whose tiles are rendered, the same one unless frames are pipelined
+		FrameContext frames[2];
+		size_t recording_frame;
+		FrameContext* rendering_frame;
+		// misc_param as the tiles and fragments see it, the snapshot of the frame while its tiles are rendered
+		const MiscParameter* frame_params;
+		uint64_t frame_index;
+		std::mutex binner_mutex;
+		// the caller's bitmap, pipelined frames render into a private framebuffer copied here once a frame is complete
+		std::unique_ptr<RawBuffer<color_bgra>> output;
+		bool pipelined;
+		std::atomic<bool> frame_in_flight;
+		// frame_mutex only guards recording into the frame state, sync_mutex serializes synchronize() which copies
+		// and clears with job system help and so must never run under a lock a worker could be waiting for
+		std::mutex frame_mutex;
+		std::mutex sync_mutex;
+		// clears and segments taken over from the recording frame by synchronize(), capacity is kept
+		std::vector<ScreenSegment> synchronized_segments;
+		// next draw sequence number, handed out in submission order
+		std::atomic<uint64_t> draw_sequence;
+		// heap allocations made by the binners and the tile task lists
+		size_t transient_allocations;
+		// clip space vertices of the current indexed draw, capacity is kept across draws
+		std::vector<Vertex> transformed_vertices;
+		// long lived workers for binning and tile rendering
+		std::unique_ptr<JobSystem> jobs;
+		// counters of every job system thread, summed into statistics by present()
+		std::vector<ThreadStatistic> thread_stats;
+		// unless NONE, workers are pinned and each owns a band of tile rows
+		AffinityPolicy affinity;
+		// layout of the device owned targets, a blocked color target is linearized into output
+		BufferLayout buffer_layout;
+		DepthFormat depth_format;
+		DepthFormat shadow_format;
+		// some tile still has a recorded clear, color of the last recorded color clear
+		std::atomic<bool> lazy_clear;
+		color_bgra clear_color;
+		std::mutex clear_mutex;
+		// framebuffer tiles, dimensions are multiples of HIZ_BLOCK_SIZE
+		uint32_t tile_width;
+		uint32_t tile_height;
+		// tiles per job when rendering them in parallel
+		uint32_t tile_task_size;
+		// work items of the current frame grouped by owner, most expensive first within a group
+		std::vector<TileRegion> regions;
+		// first region of every owner, followed by regions.size()
+		std::vector<size_t> region_offsets;
+		// next region of every owner to hand out, sized with the owners and reset every frame
+		std::vector<std::atomic<size_t>> next_region;
 		uint32_t row_tile_count;
 		uint32_t col_tile_count;
 		uint32_t tile_length;
 		FrameTile* tiles;
 
 	public:
-		void initialize(void* bitmap_handle, uint32_t w, uint32_t h);
+		void initialize(void* bitmap_handle, uint32_t w, uint32_t h, uint32_t tile_width = DEFAULT_TILE_SIZE, uint32_t tile_height = DEFAULT_TILE_SIZE, uint32_t tile_task_size = DEFAULT_TILE_TASK_SIZE);
+		void configure_tiles(uint32_t tile_width, uint32_t tile_height, uint32_t tile_task_size);
+		template <typename F>
+		TileInfo calibrate_tiles(const F& render_reference, const uint32_t& frames);
 		void draw(Shader* shader, const Vertex& v1, const Vertex& v2, const Vertex& v3, const Matrix4x4& m, const Matrix4x4& v, const Matrix4x4& p);
+		void draw(Shader* shader, const Vertex& v1, const Vertex& v2, const Vertex& v3, const Matrix4x4& m, const Matrix4x4& v, const Matrix4x4& p, const uint64_t& sequence);
+		uint64_t reserve_sequence(const size_t& count);
+		void shade_vertices(Shader* shader, const Mesh& mesh);
+		void draw_indexed(Shader* shader, const std::vector<uint32_t>& indices, const size_t& start, const size_t& end, const uint64_t& sequence);
 		void present();
 		void clear_buffer(const BufferFlag& flag);
+		void enable_frame_pipelining(const bool& enable);
+		void set_thread_affinity(const AffinityPolicy& policy);
+		void set_buffer_layout(const BufferLayout& layout);
+		void set_depth_formats(const DepthFormat& depth, const DepthFormat& shadow);
+		void finish();
+		Shader* frame_shader(Shader* shader);
 
 	public:
 		void draw_segment(const Vector3& start, const Vector3& end, const Color& col, const Matrix4x4& v, const Matrix4x4& p, const Vector2& screen_translation);
 		void draw_screen_segment(const Vector4& start, const Vector4& end, const Color& col);
+		void draw_screen_segment(const Vector4& start, const Vector4& end, const Color& col, const TileRegion& region);
 		void draw_segment(const Vector3& start, const Vector3& end, const Color& col, const Matrix4x4& m, const Matrix4x4& v, const Matrix4x4& p);
 		void draw_segment(const Vector3& start, const Vector3& end, const Color& col, const Matrix4x4& v, const Matrix4x4& p);
 		void draw_segment(const Vector4& clip_start, const Vector4& clip_end, const Color& col);
@@ -48,23 +116,62 @@ namespace Guarneri
 
 	public:
 		TileInfo get_tile_info();
-		RawBuffer<float>* get_shadowmap();
+		JobSystem& get_job_system();
+		bool parallel_submission() const;
+		DepthStencilBuffer* get_shadowmap();
 
 	private:
-		void draw_triangle(Shader* shader, const Vertex& v1, const Vertex& v2, const Vertex& v3, const Matrix4x4& m, const Matrix4x4& v, const Matrix4x4& p);
+		void draw_triangle(Shader* shader, const Vertex& v1, const Vertex& v2, const Vertex& v3, const Matrix4x4& m, const Matrix4x4& v, const Matrix4x4& p, const uint64_t& sequence);
+		void assemble_triangle(Shader* shader, const Vertex& c1, const Vertex& c2, const Vertex& c3, const uint64_t& sequence);
+		void setup_triangle(Shader* shader, const Vertex& c1, const Vertex& c2, const Vertex& c3, const uint64_t& sequence);
+		TileBinner& thread_binner();
+		GraphicsStatistic& thread_statistics();
+		void merge_statistics();
+		void reset_binners(FrameContext& frame);
+		void synchronize();
+		void apply_clear(const BufferFlag& flag);
+		void resolve_clears();
+		void clear_region(const BufferFlag& flag, const uint32_t& row_start, const uint32_t& row_end, const uint32_t& col_start, const uint32_t& col_end, const bool& streaming);
+		size_t owner_count() const;
+		void assign_tile_owners();
+		void owner_rows(const size_t& owner, uint32_t& row_start, uint32_t& row_end) const;
+		template <typename F>
+		void for_each_owner(const F& body);
+		void allocate_targets();
+		bool private_color_target() const;
+		void copy_to_output();
+		void submit_segment(const ScreenSegment& segment);
+		void plot_segment(const ScreenSegment& segment);
+		void render_frame(FrameContext& frame);
 		void render_tiles();
-		void rasterize_tiles(const size_t& start, const size_t& end);
-		void rasterize_tile(FrameTile& tile);
-		void execute_task(RawBuffer<color_bgra>* fbuf, RawBuffer<float>* zbuf, RawBuffer<uint8_t>* stencilbuf, const FrameTile& tile, const Triangle& tri, Shader* shader);
+		void prepare_tile(FrameTile& tile);
+		void build_regions(const size_t& thread_count);
+		void rasterize_region(const TileRegion& region);
+		void finish_tile(FrameTile& tile);
+		void execute_task(RawBuffer<color_bgra>* fbuf, DepthStencilBuffer* zbuf, const TileRegion& region, const BinnedTriangle& binned, const uint32_t& triangle_id);
+		const BinnedTriangle& binned_triangle(const uint32_t& index) const;
+		void resolve_tile(const TileRegion& region);
+		bool deferrable(const Shader* shader) const;
+		bool hiz_enabled(const Shader* shader, const MiscParameter& params) const;
+		float hiz_max(const int& row_start, const int& row_end, const int& col_start, const int& col_end) const;
+		void update_hiz(const int& row_start, const int& row_end, const int& col_start, const int& col_end);
+		void invalidate_hiz(const int& row_start, const int& row_end, const int& col_start, const int& col_end, const float& max_z);
 		void rasterize(const Triangle& tri, Shader* shader, const RasterizerStrategy& strategy);
 		void scanblock(const Triangle& tri, Shader* shader);
+		void traverse(RawBuffer<color_bgra>* fbuf, DepthStencilBuffer* zbuf, const TriangleSetup& setup, const int& row_start, const int& row_end, const int& col_start, const int& col_end, Shader* shader, const uint32_t& triangle_id);
+		bool traverse_pixels(RawBuffer<color_bgra>* fbuf, DepthStencilBuffer* zbuf, const TriangleSetup& setup, const int& row_start, const int& row_end, const int& col_start, const int& col_end, const bool& inside, Shader* shader, const uint32_t& triangle_id);
 		void scanline(const Triangle& tri, Shader* shader);
 		v2f process_vertex(Shader* shader, const Vertex& vert) const;
-		void process_fragment(RawBuffer<color_bgra>* fbuf, RawBuffer<float>* zbuf, RawBuffer<uint8_t>* stencilbuf, const Vertex& v, const uint32_t& row, const uint32_t& col, Shader* shader);
+		Vertex transform_vertex(Shader* shader, const Vertex& vert) const;
+		Vertex transform_vertex(Shader* shader, const a2v& input) const;
+		void shade_vertex_batch(Shader* shader, const Mesh& mesh, const size_t& start, const size_t& end);
+		static size_t l2_cache_size();
+		void process_fragment(RawBuffer<color_bgra>* fbuf, DepthStencilBuffer* zbuf, const v2f& v_out, const uint32_t& row, const uint32_t& col, Shader* shader);
+		v2f fragment_input(const Vertex& v) const;
 		bool validate_fragment(const PerSampleOperation& op_pass) const;
-		bool perform_stencil_test(RawBuffer<uint8_t>* stencilbuf, const uint8_t& ref_val, const uint8_t& read_mask, const CompareFunc& func, const uint32_t& row, const uint32_t& col) const;
-		void update_stencil_buffer(RawBuffer<uint8_t>* stencilbuf, const uint32_t& row, const uint32_t& col, const PerSampleOperation& op_pass, const StencilOp& stencil_pass_op, const StencilOp& stencil_fail_op, const StencilOp& stencil_zfail_op, const uint8_t& ref_val) const;
-		bool perform_depth_test(RawBuffer<float>* zbuf, const CompareFunc& func, const uint32_t& row, const uint32_t& col, const float& z) const;
+		bool perform_stencil_test(const uint8_t& ref_val, const uint8_t& read_mask, const CompareFunc& func, const uint8_t& stencil) const;
+		uint8_t update_stencil(const PerSampleOperation& op_pass, const StencilOp& stencil_pass_op, const StencilOp& stencil_fail_op, const StencilOp& stencil_zfail_op, const uint8_t& ref_val, const uint8_t& stencil) const;
+		bool perform_depth_test(const CompareFunc& func, const float& z, const float& depth) const;
 		Color blend(const Color& src_color, const Color& dst_color, const BlendFactor& src_factor, const BlendFactor& dst_factor, const BlendOp& op);
 		Vertex clip2ndc(const Vertex& v) const;
 		Vector4 clip2ndc(const Vector4& v) const;
@@ -75,113 +182,731 @@ namespace Guarneri
 	};
 
 
-	void GraphicsDevice::initialize(void* bitmap_handle, uint32_t w, uint32_t h)
+	void GraphicsDevice::initialize(void* bitmap_handle, uint32_t w, uint32_t h, uint32_t tile_width, uint32_t tile_height, uint32_t tile_task_size)
 	{
 		this->width = w;
 		this->height = h;
+		max_guard_band = Clipper::max_guard_band(w, h);
+
+		output = std::make_unique<RawBuffer<color_bgra>>(bitmap_handle, w, h, [](color_bgra* ptr)
+		{
+			unused(ptr); /*delete[] (void*)ptr;*/
+		});
+		output->clear(DEFAULT_COLOR);
+		lazy_clear = false;
+		clear_color = DEFAULT_COLOR;
+
+		// frame 0 is never current, so a fresh thread always binds a binner first
+		recording_frame = 0;
+		rendering_frame = &frames[0];
+		frame_params = &misc_param;
+		frame_index = 1;
+		pipelined = false;
+		frame_in_flight = false;
+		draw_sequence = 0;
+		transient_allocations = 0;
+
+		// the calling thread helps while it waits, so it is not counted as a worker
+		size_t hardware_threads = (size_t)std::thread::hardware_concurrency();
+		jobs = std::make_unique<JobSystem>(hardware_threads > 1 ? hardware_threads - 1 : 0);
+		thread_stats.resize(jobs->worker_count() + 1);
+		statistics = GraphicsStatistic();
+		deterministic = false;
+		affinity = AffinityPolicy::NONE;
+		buffer_layout = BufferLayout::LINEAR;
+		depth_format = DepthFormat::D32F;
+		shadow_format = DepthFormat::D32F;
+
+		// prepare buffers
+		allocate_targets();
 
 		// prepare tiles
-		int row_rest = h % TILE_SIZE;
-		int col_rest = w % TILE_SIZE;
-		row_tile_count = h / TILE_SIZE + (row_rest > 0 ? 1 : 0);
-		col_tile_count = w / TILE_SIZE + (col_rest > 0 ? 1 : 0);
+		configure_tiles(tile_width, tile_height, tile_task_size);
+	}
+
+	// rebuilds the tile grid, only valid between present() and the next draw.
+	// pinned workers own other rows of the new grid, so the targets are first touched again and depth and stencil are cleared
+	void GraphicsDevice::configure_tiles(uint32_t tile_width, uint32_t tile_height, uint32_t tile_task_size)
+	{
+		synchronize();
+		resolve_clears();
+		assert(frames[0].binners_in_use == 0 && frames[1].binners_in_use == 0);
+
+		// whole hiz blocks per tile, so neither hiz blocks nor 2x2 quads are shared by two tiles
+		this->tile_width = std::max(1u, (tile_width + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE) * HIZ_BLOCK_SIZE;
+		this->tile_height = std::max(1u, (tile_height + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE) * HIZ_BLOCK_SIZE;
+		this->tile_task_size = std::max(1u, tile_task_size);
+
+		int row_rest = height % this->tile_height;
+		int col_rest = width % this->tile_width;
+		row_tile_count = height / this->tile_height + (row_rest > 0 ? 1 : 0);
+		col_tile_count = width / this->tile_width + (col_rest > 0 ? 1 : 0);
 		tile_length = static_cast<int>(static_cast<long>(row_tile_count) * static_cast<long>(col_tile_count));
+		delete[] tiles;
 		tiles = new FrameTile[tile_length];
-		FrameTile::build_tiles(tiles, TILE_SIZE, row_tile_count, col_tile_count, row_rest, col_rest);
+		FrameTile::build_tiles(tiles, this->tile_width, this->tile_height, row_tile_count, col_tile_count, row_rest, col_rest);
+		// a tile is split into at most one band per hiz block row, so build_regions never grows the list
+		size_t max_regions = 0;
+		for (uint32_t tidx = 0; tidx < tile_length; tidx++)
+		{
+			tiles[tidx].max_z = hiz_max(tiles[tidx].row_start, tiles[tidx].row_end, tiles[tidx].col_start, tiles[tidx].col_end);
+			max_regions += (tiles[tidx].row_end - tiles[tidx].row_start + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+		}
+		regions.clear();
+		regions.reserve(max_regions);
+		assign_tile_owners();
+		for (auto& frame : frames)
+		{
+			for (auto& binner : frame.binners)
+			{
+				binner->resize(tile_length);
+			}
+		}
+		if (affinity != AffinityPolicy::NONE)
+		{
+			allocate_targets();
+		}
+	}
 
-		// prepare buffers
-		zbuffer = std::make_unique<RawBuffer<float>>(w, h);
-		shadowmap = std::make_unique<RawBuffer<float>>(w, h);
-		framebuffer = std::make_unique<RawBuffer<color_bgra>>(bitmap_handle, w, h, [](color_bgra* ptr)
+	// renders the reference scene with every candidate layout and keeps the fastest one.
+	// candidates whose color, depth and stencil tile does not fit in L2 are skipped, as are
+	// task sizes leaving fewer jobs than threads
+	template <typename F>
+	TileInfo GraphicsDevice::calibrate_tiles(const F& render_reference, const uint32_t& frames)
+	{
+		const uint32_t sizes[] = { 32, 64, 128, 256 };
+		const uint32_t task_sizes[] = { 1, 2, 4 };
+		const size_t bytes_per_pixel = sizeof(color_bgra) + zbuffer->bytes_per_pixel();
+		size_t cache_size = l2_cache_size();
+		size_t thread_count = multi_thread ? jobs->worker_count() + 1 : 1;
+
+		uint32_t best_width = tile_width, best_height = tile_height, best_task_size = tile_task_size;
+		double best_time = DBL_MAX;
+		for (uint32_t tw : sizes)
 		{
-			unused(ptr); /*delete[] (void*)ptr;*/
-		});
-		stencilbuffer = std::make_unique<RawBuffer<uint8_t>>(w, h);
-		zbuffer->clear(FAR_Z);
-		shadowmap->clear(FAR_Z);
-		stencilbuffer->clear(DEFAULT_STENCIL);
-		framebuffer->clear(DEFAULT_COLOR);
+			for (uint32_t th : sizes)
+			{
+				// wide tiles keep rows contiguous, taller than wide is never better
+				if (th > tw || (size_t)tw * th * bytes_per_pixel > cache_size)
+				{
+					continue;
+				}
+				for (uint32_t task_size : task_sizes)
+				{
+					configure_tiles(tw, th, task_size);
+					if (task_size > 1 && tile_length / task_size < thread_count)
+					{
+						continue;
+					}
+					auto start = std::chrono::steady_clock::now();
+					for (uint32_t frame = 0; frame < frames; frame++)
+					{
+						render_reference();
+					}
+					// a pipelined frame is only timed once its tiles are rendered
+					synchronize();
+					double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+					if (total < best_time)
+					{
+						best_time = total;
+						best_width = tw;
+						best_height = th;
+						best_task_size = task_size;
+					}
+				}
+			}
+		}
+		configure_tiles(best_width, best_height, best_task_size);
+		return get_tile_info();
 	}
 
 	// todo: ugly impl, fix it
-	RawBuffer<float>* GraphicsDevice::get_shadowmap()
+	DepthStencilBuffer* GraphicsDevice::get_shadowmap()
 	{
 		return shadowmap.get();
 	}
 
+	JobSystem& GraphicsDevice::get_job_system()
+	{
+		return *jobs;
+	}
+
+	// tiles apply triangles in sequence order whichever thread binned them, anything else is only ordered when drawn serially
+	bool GraphicsDevice::parallel_submission() const
+	{
+		return multi_thread && (tile_based || !deterministic);
+	}
+
 	TileInfo GraphicsDevice::get_tile_info()
 	{
-		return { TILE_SIZE , TILE_TASK_SIZE , row_tile_count, col_tile_count, tile_length };
+		return { tile_width, tile_height, tile_task_size, row_tile_count, col_tile_count, tile_length };
 	}
 
 	void GraphicsDevice::draw(Shader* shader, const Vertex& v1, const Vertex& v2, const Vertex& v3, const Matrix4x4& m, const Matrix4x4& v, const Matrix4x4& p)
 	{
+		draw(shader, v1, v2, v3, m, v, p, reserve_sequence(1));
+	}
+
+	void GraphicsDevice::draw(Shader* shader, const Vertex& v1, const Vertex& v2, const Vertex& v3, const Matrix4x4& m, const Matrix4x4& v, const Matrix4x4& p, const uint64_t& sequence)
+	{
+		if (!tile_based)
+		{
+			// immediate rasterization writes the targets the frame in flight is still rendering
+			synchronize();
+			resolve_clears();
+		}
 		auto object_space_frustum = Frustum::create(p * v * m);
 		if ((misc_param.culling_clipping_flag & CullingAndClippingFlag::APP_FRUSTUM_CULLING) != CullingAndClippingFlag::DISABLE)
 		{
 			if (Clipper::conservative_frustum_culling(object_space_frustum, v1, v2, v3))
 			{
-				statistics.culled_triangle_count++;
+				thread_statistics().culled_triangle_count++;
 				return;
 			}
 		}
-		if ((misc_param.culling_clipping_flag & CullingAndClippingFlag::NEAR_PLANE_CLIPPING) != CullingAndClippingFlag::DISABLE)
+		draw_triangle(shader, v1, v2, v3, m, v, p, sequence);
+	}
+
+	// reserves count consecutive sequence numbers, the order of reservation is the draw order
+	uint64_t GraphicsDevice::reserve_sequence(const size_t& count)
+	{
+		return draw_sequence.fetch_add(count);
+	}
+
+	// with pipelined frames the recorded frame is rasterized by the job system while the caller records the next one,
+	// present() then only waits for the frame before it
+	void GraphicsDevice::present()
+	{
+		synchronize();
+		if (tile_based)
 		{
-			auto triangles = Clipper::near_plane_clipping(object_space_frustum.near, v1, v2, v3);
-			if (triangles.size() == 0)
+			FrameContext& frame = frames[recording_frame];
+			frame.params = misc_param;
+			if (pipelined && !frame.shared_shaders)
 			{
-				statistics.culled_triangle_count++;
-				return;
+				// the counters are summed while no other thread is running
+				merge_statistics();
+				{
+					std::lock_guard<std::mutex> lock(binner_mutex);
+					recording_frame ^= 1;
+					frame_index++;
+				}
+				frame_in_flight = true;
+				jobs->submit([](void* context, size_t frame_idx, size_t)
+				{
+					GraphicsDevice* device = static_cast<GraphicsDevice*>(context);
+					device->render_frame(device->frames[frame_idx]);
+				}, this, recording_frame ^ 1, (recording_frame ^ 1) + 1, frame.fence);
 			}
-			for (size_t idx = 0; idx < triangles.size(); idx++)
+			else
 			{
-				auto tri = triangles[idx];
-				draw_triangle(shader, tri[0], tri[1], tri[2], m, v, p);
+				render_frame(frame);
+				merge_statistics();
+				std::lock_guard<std::mutex> lock(binner_mutex);
+				frame_index++;
 			}
 		}
 		else
 		{
-			draw_triangle(shader, v1, v2, v3, m, v, p);
+			resolve_clears();
+			merge_statistics();
+		}
+		// a blocked color target shown without latency is linearized right away
+		if (!pipelined && private_color_target())
+		{
+			copy_to_output();
+		}
+		size_t allocations = transient_allocations;
+		for (uint32_t tidx = 0; tidx < tile_length; tidx++)
+		{
+			allocations += tiles[tidx].task_allocations;
+		}
+		for (auto& frame : frames)
+		{
+			for (size_t idx = 0; idx < frame.binners.size(); idx++)
+			{
+				allocations += frame.binners[idx]->allocations;
+			}
 		}
+		statistics.transient_allocation_count = (uint32_t)allocations;
 	}
 
-	void GraphicsDevice::present()
+	// clears issued while a frame is in flight are applied once it is done, in order with the segments drawn meanwhile
+	void GraphicsDevice::clear_buffer(const BufferFlag& flag)
 	{
-		if (tile_based)
+		bool deferred = false;
+		if (frame_in_flight)
 		{
-			render_tiles();
+			std::lock_guard<std::mutex> lock(frame_mutex);
+			if (frame_in_flight)
+			{
+				FrameContext& frame = frames[recording_frame];
+				frame.pending_clear = frame.pending_clear | flag;
+				frame.clear_segment = frame.segments.size();
+				deferred = true;
+			}
 		}
+		if (!deferred)
+		{
+			apply_clear(flag);
+		}
+		statistics.culled_triangle_count = 0;
+		statistics.culled_backface_triangle_count = 0;
+		statistics.triangle_count = 0;
+		statistics.earlyz_optimized = 0;
+		statistics.hiz_tile_optimized = 0;
+		statistics.hiz_block_optimized = 0;
+		statistics.binned_tile_count = 0;
+		statistics.overlap_rejected_tile_count = 0;
+		statistics.tile_region_count = 0;
+		statistics.split_tile_count = 0;
+		statistics.worker_idle_time = 0.0f;
+		statistics.depth_only_triangle_count = 0;
+		statistics.shaded_fragment_count = 0;
+		statistics.fast_cleared_tile_count = 0;
 	}
 
-	void GraphicsDevice::clear_buffer(const BufferFlag& flag)
+	// clears are only recorded on the tiles. each tile applies them while it is rendered, by the worker rendering it,
+	// and tiles no triangle touches are filled with streaming stores as regions of their own, see build_regions.
+	// writes that bypass the tiles call resolve_clears first
+	void GraphicsDevice::apply_clear(const BufferFlag& flag)
 	{
 		if ((flag & BufferFlag::COLOR) != BufferFlag::NONE)
 		{
-			if ((misc_param.render_flag & RenderFlag::DEPTH) != RenderFlag::DISABLE || (misc_param.render_flag & RenderFlag::SHADOWMAP) != RenderFlag::DISABLE)
+			bool debug_view = (misc_param.render_flag & RenderFlag::DEPTH) != RenderFlag::DISABLE || (misc_param.render_flag & RenderFlag::SHADOWMAP) != RenderFlag::DISABLE;
+			clear_color = debug_view ? DEFAULT_DEPTH_COLOR : DEFAULT_COLOR;
+		}
+		for (uint32_t tidx = 0; tidx < tile_length; tidx++)
+		{
+			tiles[tidx].clear_flag = tiles[tidx].clear_flag | flag;
+			if ((flag & BufferFlag::DEPTH) != BufferFlag::NONE)
 			{
-				framebuffer->clear(DEFAULT_DEPTH_COLOR);
+				tiles[tidx].max_z = FAR_Z;
 			}
-			else
+		}
+		lazy_clear = true;
+	}
+
+	// applies every recorded clear right away, safe to call from several drawing threads
+	void GraphicsDevice::resolve_clears()
+	{
+		if (!lazy_clear)
+		{
+			return;
+		}
+		std::lock_guard<std::mutex> lock(clear_mutex);
+		if (!lazy_clear)
+		{
+			return;
+		}
+		for (uint32_t tidx = 0; tidx < tile_length; tidx++)
+		{
+			FrameTile& tile = tiles[tidx];
+			clear_region(tile.clear_flag, tile.row_start, tile.row_end, tile.col_start, tile.col_end, false);
+			tile.clear_flag = BufferFlag::NONE;
+		}
+		lazy_clear = false;
+	}
+
+	void GraphicsDevice::clear_region(const BufferFlag& flag, const uint32_t& row_start, const uint32_t& row_end, const uint32_t& col_start, const uint32_t& col_end, const bool& streaming)
+	{
+		if ((flag & BufferFlag::COLOR) != BufferFlag::NONE)
+		{
+			framebuffer->clear(clear_color, row_start, row_end, col_start, col_end, streaming);
+		}
+		// depth and stencil of a packed format are cleared in one pass
+		zbuffer->clear(flag, FAR_Z, DEFAULT_STENCIL, row_start, row_end, col_start, col_end, streaming);
+		if ((flag & BufferFlag::DEPTH) != BufferFlag::NONE)
+		{
+			shadowmap->clear(BufferFlag::DEPTH, FAR_Z, DEFAULT_STENCIL, row_start, row_end, col_start, col_end, streaming);
+			hizbuffer->clear(FAR_Z, row_start / HIZ_BLOCK_SIZE, (row_end + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE, col_start / HIZ_BLOCK_SIZE, (col_end + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE, false);
+		}
+	}
+
+	// pins the workers and hands each a fixed band of tile rows. the device owned buffers are reallocated
+	// and first touched by the owners, so on numa systems their pages live on the node of the worker rendering them.
+	// only valid between present() and the next draw, the buffers are cleared
+	void GraphicsDevice::set_thread_affinity(const AffinityPolicy& policy)
+	{
+		if (policy == affinity)
+		{
+			return;
+		}
+		synchronize();
+		jobs->set_affinity(policy);
+		affinity = policy;
+		assign_tile_owners();
+		allocate_targets();
+	}
+
+	// tiled and morton targets keep every BUFFER_BLOCK_SIZE square block in consecutive memory, so a tile walks far fewer
+	// cache lines and pages and pcf taps mostly hit the same block. only valid between present() and the next draw,
+	// depth and stencil are cleared
+	void GraphicsDevice::set_buffer_layout(const BufferLayout& layout)
+	{
+		if (layout == buffer_layout)
+		{
+			return;
+		}
+		synchronize();
+		buffer_layout = layout;
+		allocate_targets();
+	}
+
+	// 16 bits halve the depth traffic of shadow passes, D24S8 tests depth and stencil with a single load and store.
+	// only valid between present() and the next draw, depth and stencil are cleared
+	void GraphicsDevice::set_depth_formats(const DepthFormat& depth, const DepthFormat& shadow)
+	{
+		if (depth == depth_format && shadow == shadow_format)
+		{
+			return;
+		}
+		synchronize();
+		depth_format = depth;
+		shadow_format = shadow;
+		allocate_targets();
+	}
+
+	// creates the device owned targets in the current layout, first touched by the owners of their rows.
+	// the color target keeps its pixels, depth and stencil start cleared
+	void GraphicsDevice::allocate_targets()
+	{
+		zbuffer = std::make_unique<DepthStencilBuffer>(width, height, depth_format, buffer_layout, true);
+		shadowmap = std::make_unique<DepthStencilBuffer>(width, height, shadow_format, buffer_layout, false);
+		visibilitybuffer = std::make_unique<RawBuffer<VisibilitySample>>(width, height, buffer_layout);
+		hizbuffer = std::make_unique<RawBuffer<float>>((width + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE, (height + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE);
+		RawBuffer<color_bgra>* previous = framebuffer != nullptr ? framebuffer.get() : output.get();
+		std::unique_ptr<RawBuffer<color_bgra>> color;
+		int size;
+		if (private_color_target())
+		{
+			color = std::make_unique<RawBuffer<color_bgra>>(width, height, buffer_layout);
+		}
+		else
+		{
+			color = std::make_unique<RawBuffer<color_bgra>>(output->get_ptr(size), width, height, [](color_bgra* ptr)
+			{
+				unused(ptr);
+			});
+		}
+		bool copy_color = previous->get_ptr(size) != color->get_ptr(size);
+		for_each_owner([this, previous, copy_color, &color](uint32_t row_start, uint32_t row_end)
+		{
+			if (copy_color)
 			{
-				framebuffer->clear(DEFAULT_COLOR);
+				previous->copy_pixels(*color, row_start, row_end);
 			}
+			clear_region(BufferFlag::DEPTH | BufferFlag::STENCIL, row_start, row_end, 0, width, false);
+			visibilitybuffer->clear({ INVALID_TRIANGLE_ID, 0.0f, 0.0f }, row_start, row_end);
+		});
+		// clear_region only reaches the color target through framebuffer
+		framebuffer = std::move(color);
+		for (uint32_t tidx = 0; tidx < tile_length; tidx++)
+		{
+			tiles[tidx].max_z = FAR_Z;
 		}
-		if ((flag & BufferFlag::DEPTH) != BufferFlag::NONE)
+	}
+
+	// the bitmap is only rendered to directly when it is linear and not shown one frame late
+	bool GraphicsDevice::private_color_target() const
+	{
+		return pipelined || buffer_layout != BufferLayout::LINEAR;
+	}
+
+	// linearizes the private color target into the bitmap, owners copy their own rows,
+	// without owners the rows are split into bands of a tile row across the job system
+	void GraphicsDevice::copy_to_output()
+	{
+		if (owner_count() > 0)
 		{
-			zbuffer->clear(FAR_Z);
-			shadowmap->clear(FAR_Z);
+			for_each_owner([this](uint32_t row_start, uint32_t row_end)
+			{
+				framebuffer->copy_pixels(*output, row_start, row_end);
+			});
 		}
-		if ((flag & BufferFlag::STENCIL) != BufferFlag::NONE)
+		else if (multi_thread)
 		{
-			stencilbuffer->clear(DEFAULT_STENCIL);
+			jobs->parallel_for(height, tile_height, [this](size_t start, size_t end)
+			{
+				framebuffer->copy_pixels(*output, (uint32_t)start, (uint32_t)end);
+			});
+		}
+		else
+		{
+			framebuffer->copy_pixels(*output);
+		}
+	}
+
+	// workers owning tiles, 0 when tiles have no owner
+	size_t GraphicsDevice::owner_count() const
+	{
+		return affinity != AffinityPolicy::NONE ? jobs->worker_count() : 0;
+	}
+
+	// contiguous bands of tile rows, so each buffer page is mostly written by a single owner
+	void GraphicsDevice::assign_tile_owners()
+	{
+		size_t owners = std::max((size_t)1, owner_count());
+		if (next_region.size() != owners)
+		{
+			next_region = std::vector<std::atomic<size_t>>(owners);
+		}
+		for (uint32_t tidx = 0; tidx < tile_length; tidx++)
+		{
+			size_t tile_row = tidx / col_tile_count;
+			tiles[tidx].owner = (uint32_t)(tile_row * owners / row_tile_count);
+		}
+	}
+
+	// pixel rows of the tile rows r with r * owners / row_tile_count == owner
+	void GraphicsDevice::owner_rows(const size_t& owner, uint32_t& row_start, uint32_t& row_end) const
+	{
+		size_t owners = std::max((size_t)1, owner_count());
+		size_t first = (owner * row_tile_count + owners - 1) / owners;
+		size_t last = ((owner + 1) * row_tile_count + owners - 1) / owners;
+		row_start = (uint32_t)std::min((size_t)height, first * tile_height);
+		row_end = (uint32_t)std::min((size_t)height, last * tile_height);
+	}
+
+	// runs body(row_start, row_end) on every owner for its own rows, or once for all rows on the calling thread
+	template <typename F>
+	void GraphicsDevice::for_each_owner(const F& body)
+	{
+		size_t owners = owner_count();
+		if (owners == 0)
+		{
+			body(0u, height);
+			return;
+		}
+		struct OwnerJob
+		{
+			GraphicsDevice* device;
+			const F* body;
+		};
+		OwnerJob context = { this, &body };
+		JobCounter fence;
+		for (size_t owner = 0; owner < owners; owner++)
+		{
+			jobs->submit_to(owner, [](void* job_context, size_t start, size_t end)
+			{
+				unused(end);
+				OwnerJob* job = static_cast<OwnerJob*>(job_context);
+				uint32_t row_start, row_end;
+				job->device->owner_rows(start, row_start, row_end);
+				(*job->body)(row_start, row_end);
+			}, &context, owner, owner + 1, fence);
+		}
+		jobs->wait(fence);
+	}
+
+	// trades one frame of latency for overlapping vertex processing and binning with tile rendering,
+	// the output bitmap then shows the previous complete frame
+	void GraphicsDevice::enable_frame_pipelining(const bool& enable)
+	{
+		if (enable == pipelined)
+		{
+			return;
+		}
+		synchronize();
+		bool was_private = private_color_target();
+		pipelined = enable;
+		if (private_color_target() != was_private)
+		{
+			int size;
+			auto color = private_color_target() ? std::make_unique<RawBuffer<color_bgra>>(width, height, buffer_layout) : std::make_unique<RawBuffer<color_bgra>>(output->get_ptr(size), width, height, [](color_bgra* ptr)
+			{
+				unused(ptr);
+			});
+			framebuffer->copy_pixels(*color);
+			framebuffer = std::move(color);
+		}
+		else if (was_private)
+		{
+			framebuffer->copy_pixels(*output);
+		}
+	}
+
+	// waits for every presented frame and copies the last one to the output, for callers reading the bitmap directly
+	void GraphicsDevice::finish()
+	{
+		synchronize();
+		if (private_color_target())
+		{
+			copy_to_output();
+		}
+	}
+
+	// the shader a draw of the recording frame has to bin, pipelined frames keep their own copy so the caller
+	// can update materials and misc_param while the frame is rasterized
+	Shader* GraphicsDevice::frame_shader(Shader* shader)
+	{
+		if (!pipelined || !tile_based)
+		{
+			return shader;
+		}
+		std::unique_ptr<Shader> copy = shader->clone();
+		std::lock_guard<std::mutex> lock(frame_mutex);
+		FrameContext& frame = frames[recording_frame];
+		// a derived shader without its own clone() would lose its stages, the frame then shares it and is not pipelined
+		if (typeid(*copy) != typeid(*shader))
+		{
+			frame.shared_shaders = true;
+			return shader;
+		}
+		copy->params = &frame.params;
+		// every copy is a heap allocation, as is growing the list, both are counted as transient
+		size_t allocations = frame.shaders.size() == frame.shaders.capacity() ? 2 : 1;
+		frame.shaders.emplace_back(std::move(copy));
+		{
+			std::lock_guard<std::mutex> counter_lock(binner_mutex);
+			transient_allocations += allocations;
+		}
+		return frame.shaders.back().get();
+	}
+
+	// waits for the frame in flight, then brings the targets to the state the recording frame starts from,
+	// a frame is complete once the next one clears color, so that is when it is copied to the output.
+	// only called by submitting threads, never from inside a job
+	void GraphicsDevice::synchronize()
+	{
+		if (!frame_in_flight)
+		{
+			return;
+		}
+		jobs->wait(frames[recording_frame ^ 1].fence);
+		std::lock_guard<std::mutex> sync_lock(sync_mutex);
+		while (frame_in_flight)
+		{
+			// clears and segments recorded meanwhile are taken in order, the frame stays in flight until none are left
+			BufferFlag pending_clear;
+			size_t clear_segment;
+			{
+				std::lock_guard<std::mutex> lock(frame_mutex);
+				FrameContext& frame = frames[recording_frame];
+				if (frame.pending_clear == BufferFlag::NONE && frame.segments.empty())
+				{
+					frame_in_flight = false;
+					return;
+				}
+				pending_clear = frame.pending_clear;
+				clear_segment = pending_clear != BufferFlag::NONE ? frame.clear_segment : frame.segments.size();
+				synchronized_segments.swap(frame.segments);
+				frame.pending_clear = BufferFlag::NONE;
+				frame.clear_segment = 0;
+			}
+			for (size_t idx = 0; idx < clear_segment; idx++)
+			{
+				plot_segment(synchronized_segments[idx]);
+			}
+			if (pending_clear != BufferFlag::NONE)
+			{
+				if ((pending_clear & BufferFlag::COLOR) != BufferFlag::NONE)
+				{
+					copy_to_output();
+				}
+				apply_clear(pending_clear);
+			}
+			for (size_t idx = clear_segment; idx < synchronized_segments.size(); idx++)
+			{
+				plot_segment(synchronized_segments[idx]);
+			}
+			synchronized_segments.clear();
+		}
+	}
+
+	// segments issued while a frame is in flight are drawn once it is done
+	void GraphicsDevice::submit_segment(const ScreenSegment& segment)
+	{
+		if (frame_in_flight)
+		{
+			std::lock_guard<std::mutex> lock(frame_mutex);
+			if (frame_in_flight)
+			{
+				frames[recording_frame].segments.push_back(segment);
+				return;
+			}
+		}
+		plot_segment(segment);
+	}
+
+	void GraphicsDevice::plot_segment(const ScreenSegment& segment)
+	{
+		resolve_clears();
+		SegmentDrawer::bresenham(framebuffer.get(), segment.x0, segment.y0, segment.x1, segment.y1, segment.color);
+	}
+
+	void GraphicsDevice::render_frame(FrameContext& frame)
+	{
+		rendering_frame = &frame;
+		frame_params = &frame.params;
+		render_tiles();
+		frame_params = &misc_param;
+		// every tile has been resolved, ids and shader copies can be reused
+		reset_binners(frame);
+		frame.shaders.clear();
+		frame.shared_shaders = false;
+	}
+
+	// vertex stage of an indexed draw, every vertex is shaded once however many triangles share it
+	void GraphicsDevice::shade_vertices(Shader* shader, const Mesh& mesh)
+	{
+		assert(shader != nullptr);
+		if (!tile_based)
+		{
+			// immediate rasterization writes the targets the frame in flight is still rendering,
+			// waited for here on the submitting thread before draw_indexed fans the triangles out to jobs
+			synchronize();
+			resolve_clears();
+		}
+		size_t vertex_count = mesh.vertex_count();
+		if (transformed_vertices.capacity() < vertex_count)
+		{
+			std::lock_guard<std::mutex> lock(binner_mutex);
+			transient_allocations++;
+		}
+		transformed_vertices.resize(vertex_count);
+		if (multi_thread)
+		{
+			jobs->parallel_for(vertex_count, VERTEX_BATCH_SIZE, [this, shader, &mesh](size_t start, size_t end)
+			{
+				shade_vertex_batch(shader, mesh, start, end);
+			});
+		}
+		else
+		{
+			shade_vertex_batch(shader, mesh, 0, vertex_count);
+		}
+	}
+
+	// vertices [start, end) are fetched from the mesh streams in small batches, then shaded one by one
+	void GraphicsDevice::shade_vertex_batch(Shader* shader, const Mesh& mesh, const size_t& start, const size_t& end)
+	{
+		a2v inputs[VERTEX_FETCH_SIZE];
+		for (size_t batch_start = start; batch_start < end; batch_start += VERTEX_FETCH_SIZE)
+		{
+			size_t batch_end = std::min(batch_start + VERTEX_FETCH_SIZE, end);
+			mesh.fetch(batch_start, batch_end, inputs);
+			for (size_t vidx = batch_start; vidx < batch_end; vidx++)
+			{
+				transformed_vertices[vidx] = transform_vertex(shader, inputs[vidx - batch_start]);
+			}
+		}
+	}
+
+	// primitive assembly of the triangles [start, end) from the vertices shade_vertices left, triangle i is drawn with sequence + i.
+	// triangles completely outside the frustum are rejected in clip space by the clipper
+	void GraphicsDevice::draw_indexed(Shader* shader, const std::vector<uint32_t>& indices, const size_t& start, const size_t& end, const uint64_t& sequence)
+	{
+		assert(end * 3 <= indices.size());
+		for (size_t tidx = start; tidx < end; tidx++)
+		{
+			const uint32_t* index = &indices[tidx * 3];
+			assert(index[0] < transformed_vertices.size() && index[1] < transformed_vertices.size() && index[2] < transformed_vertices.size());
+			assemble_triangle(shader, transformed_vertices[index[0]], transformed_vertices[index[1]], transformed_vertices[index[2]], sequence + tidx);
 		}
-		statistics.culled_triangle_count = 0;
-		statistics.culled_backface_triangle_count = 0;
-		statistics.triangle_count = 0;
-		statistics.earlyz_optimized = 0;
 	}
 
-	void GraphicsDevice::draw_triangle(Shader* shader, const Vertex& v1, const Vertex& v2, const Vertex& v3, const Matrix4x4& m, const Matrix4x4& v, const Matrix4x4& p)
+	void GraphicsDevice::draw_triangle(Shader* shader, const Vertex& v1, const Vertex& v2, const Vertex& v3, const Matrix4x4& m, const Matrix4x4& v, const Matrix4x4& p, const uint64_t& sequence)
 	{
 		assert(shader != nullptr);
 
@@ -189,21 +914,36 @@ namespace Guarneri
 		REF(v);
 		REF(p);
 
-		statistics.triangle_count++;
-
-		v2f o1 = process_vertex(shader, v1);
-		v2f o2 = process_vertex(shader, v2);
-		v2f o3 = process_vertex(shader, v3);
-
-		Vertex c1(o1.position, o1.world_pos, o1.shadow_coord, o1.color, o1.normal, o1.uv, o1.tangent, o1.bitangent);
-		Vertex c2(o2.position, o2.world_pos, o2.shadow_coord, o2.color, o2.normal, o2.uv, o2.tangent, o2.bitangent);
-		Vertex c3(o3.position, o3.world_pos, o3.shadow_coord, o3.color, o3.normal, o3.uv, o3.tangent, o3.bitangent);
+		assemble_triangle(shader, transform_vertex(shader, v1), transform_vertex(shader, v2), transform_vertex(shader, v3), sequence);
+	}
 
-		// clip in screen space
-		//if (!shader->skybox && Clipper::cvv_clipping(c1.position, c2.position, c3.position)) {
-		//	return;
-		//}
+	// clip space triangle to clipped fan triangles
+	void GraphicsDevice::assemble_triangle(Shader* shader, const Vertex& c1, const Vertex& c2, const Vertex& c3, const uint64_t& sequence)
+	{
+		// clip space clipping, only triangles leaving the guard band are cut, without one x and y are still clipped
+		// where the fixed point range ends
+		bool guard_band = (misc_param.culling_clipping_flag & CullingAndClippingFlag::GUARD_BAND_CLIPPING) != CullingAndClippingFlag::DISABLE;
+		Vertex clipped[MAX_CLIP_VERTICES];
+		size_t clipped_count = Clipper::homogeneous_clipping(c1, c2, c3, guard_band ? misc_param.guard_band : 0.0f, max_guard_band, clipped);
+		if (clipped_count == 0)
+		{
+			thread_statistics().culled_triangle_count++;
+			return;
+		}
+		thread_statistics().triangle_count++;
+		if (shader->color_mask == ColorMask::ZERO)
+		{
+			thread_statistics().depth_only_triangle_count++;
+		}
+		for (size_t idx = 1; idx + 1 < clipped_count; idx++)
+		{
+			setup_triangle(shader, clipped[0], clipped[idx], clipped[idx + 1], (sequence << SEQUENCE_FAN_BITS) | (idx - 1));
+		}
+	}
 
+	// clip space triangle to screen space, then binned or rasterized
+	void GraphicsDevice::setup_triangle(Shader* shader, const Vertex& c1, const Vertex& c2, const Vertex& c3, const uint64_t& sequence)
+	{
 		// perspective division, position.
 		Vertex n1 = clip2ndc(c1);
 		Vertex n2 = clip2ndc(c2);
@@ -221,7 +961,7 @@ namespace Guarneri
 				culled_back_face = true;
 				if ((misc_param.render_flag & RenderFlag::CULLED_BACK_FACE) == RenderFlag::DISABLE)
 				{
-					statistics.culled_backface_triangle_count++;
+					thread_statistics().culled_backface_triangle_count++;
 					return;
 				}
 			}
@@ -238,24 +978,139 @@ namespace Guarneri
 
 		Triangle tri(s1, s2, s3);
 
-		// primitive assembly
-		std::vector<Triangle> tris = tri.horizontally_split();
+		if (culled_back_face && (misc_param.render_flag & RenderFlag::CULLED_BACK_FACE) != RenderFlag::DISABLE)
+		{
+			tri.culled = true;
+		}
 
-		for (auto iter = tris.begin(); iter != tris.end(); iter++)
+		// edge functions are set up once here, tiles only walk them
+		if (tile_based)
 		{
-			if (culled_back_face && (misc_param.render_flag & RenderFlag::CULLED_BACK_FACE) != RenderFlag::DISABLE)
+			// set up once into the frame-wide triangle records, tiles only store the index
+			TileBinner& binner = thread_binner();
+			BinnedTriangle& binned = binner.push_triangle();
+			if (!binned.setup.initialize(tri, shader->varyings))
 			{
-				(*iter).culled = true;
+				binner.triangles.pop_back();
 			}
-			if (tile_based)
+			else
 			{
-				FrameTile::dispatch_render_task(tiles, *iter, shader, this->width, this->height, TILE_SIZE, this->col_tile_count);
+				binned.shader = shader;
+				binned.sequence = sequence;
+				binned.deferred = deferrable(shader);
+				binned.culled = tri.culled;
+				for (uint32_t idx = 0; idx < 3; idx++)
+				{
+					binned.positions[idx] = tri[idx].position;
+				}
+				// wireframe and culled face debug views are drawn per task, so every bounding box tile is still binned
+				bool debug_view = (misc_param.render_flag & (RenderFlag::WIREFRAME | RenderFlag::CULLED_BACK_FACE)) != RenderFlag::DISABLE;
+				bool overlap_test = !debug_view && (misc_param.culling_clipping_flag & CullingAndClippingFlag::TILE_OVERLAP_CULLING) != CullingAndClippingFlag::DISABLE;
+				// tile depth belongs to the frame in flight while frames are pipelined
+				bool hiz_test = !debug_view && !pipelined && hiz_enabled(shader, misc_param);
+				BinningStatistic binning = FrameTile::dispatch_render_task(tiles, binner, (uint32_t)binner.triangles.size() - 1, overlap_test, hiz_test, this->width, this->height, tile_width, tile_height, this->col_tile_count);
+				thread_statistics().hiz_tile_optimized += binning.occluded;
+				thread_statistics().binned_tile_count += binning.binned;
+				thread_statistics().overlap_rejected_tile_count += binning.rejected;
 			}
-			else
+			return;
+		}
+
+		// primitive assembly
+		Triangle tris[2];
+		size_t count = tri.horizontally_split(tris);
+
+		for (size_t idx = 0; idx < count; idx++)
+		{
+			tris[idx].culled = tri.culled;
+			rasterize(tris[idx], shader, RasterizerStrategy::SCANLINE);
+		}
+	}
+
+	// draw calls run on short lived pool threads, so a binner is bound to a thread only for the current frame,
+	// the lock is taken once per thread and frame, binning itself never locks.
+	// a thread filling the local index space of its binner moves on to another one, tiles merge them by sequence anyway
+	TileBinner& GraphicsDevice::thread_binner()
+	{
+		static thread_local TileBinner* binner = nullptr;
+		static thread_local uint64_t binner_frame = 0;
+		if (binner == nullptr || binner_frame != frame_index || binner->full())
+		{
+			std::lock_guard<std::mutex> lock(binner_mutex);
+			FrameContext& frame = frames[recording_frame];
+			if (frame.binners_in_use == frame.binners.size())
 			{
-				rasterize(*iter, shader, RasterizerStrategy::SCANLINE);
+				// every binner full would take 2^32 triangle records in memory
+				assert(frame.binners.size() < MAX_TILE_BINNERS);
+				frame.binners.emplace_back(std::make_unique<TileBinner>((uint32_t)frame.binners.size(), tile_length));
+				transient_allocations++;
 			}
+			binner = frame.binners[frame.binners_in_use++].get();
+			binner_frame = frame_index;
 		}
+		return *binner;
+	}
+
+	// counters are only written by the thread owning them, so neither counting nor summing races
+	GraphicsStatistic& GraphicsDevice::thread_statistics()
+	{
+		return thread_stats[jobs->thread_index()].counters;
+	}
+
+	void GraphicsDevice::merge_statistics()
+	{
+		for (auto& thread_stat : thread_stats)
+		{
+			const GraphicsStatistic& counters = thread_stat.counters;
+			statistics.triangle_count += counters.triangle_count;
+			statistics.culled_triangle_count += counters.culled_triangle_count;
+			statistics.culled_backface_triangle_count += counters.culled_backface_triangle_count;
+			statistics.earlyz_optimized += counters.earlyz_optimized;
+			statistics.hiz_tile_optimized += counters.hiz_tile_optimized;
+			statistics.hiz_block_optimized += counters.hiz_block_optimized;
+			statistics.binned_tile_count += counters.binned_tile_count;
+			statistics.overlap_rejected_tile_count += counters.overlap_rejected_tile_count;
+			statistics.tile_region_count += counters.tile_region_count;
+			statistics.split_tile_count += counters.split_tile_count;
+			statistics.worker_idle_time += counters.worker_idle_time;
+			statistics.depth_only_triangle_count += counters.depth_only_triangle_count;
+			statistics.shaded_fragment_count += counters.shaded_fragment_count;
+			statistics.fast_cleared_tile_count += counters.fast_cleared_tile_count;
+			thread_stat.counters = GraphicsStatistic();
+		}
+	}
+
+	// called once every binned task has been consumed, capacities stay allocated for the next frame
+	void GraphicsDevice::reset_binners(FrameContext& frame)
+	{
+		for (size_t idx = 0; idx < frame.binners_in_use; idx++)
+		{
+			frame.binners[idx]->reset();
+		}
+		frame.binners_in_use = 0;
+	}
+
+	// cpuid leaf 0x80000006 reports the L2 size in KB on both vendors
+	size_t GraphicsDevice::l2_cache_size()
+	{
+		uint32_t ecx = 0;
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0x80000000);
+		if ((uint32_t)info[0] >= 0x80000006)
+		{
+			__cpuid(info, 0x80000006);
+			ecx = (uint32_t)info[2];
+		}
+#else
+		uint32_t eax, ebx, edx;
+		if (__get_cpuid(0x80000006, &eax, &ebx, &ecx, &edx) == 0)
+		{
+			ecx = 0;
+		}
+#endif
+		size_t kilobytes = ecx >> 16;
+		return kilobytes > 0 ? kilobytes * 1024 : DEFAULT_L2_CACHE_SIZE;
 	}
 
 	// per vertex processing
@@ -270,80 +1125,239 @@ namespace Guarneri
 		return shader->vertex_shader(input);
 	}
 
-	void GraphicsDevice::render_tiles()
+	Vertex GraphicsDevice::transform_vertex(Shader* shader, const Vertex& vert) const
+	{
+		v2f o = process_vertex(shader, vert);
+		return Vertex(o.position, o.world_pos, o.shadow_coord, o.color, o.normal, o.uv, o.tangent, o.bitangent);
+	}
+
+	Vertex GraphicsDevice::transform_vertex(Shader* shader, const a2v& input) const
+	{
+		v2f o = shader->vertex_shader(input);
+		return Vertex(o.position, o.world_pos, o.shadow_coord, o.color, o.normal, o.uv, o.tangent, o.bitangent);
+	}
+
+	// tiles are merged and costed first, then rendered as regions in descending cost,
+	// oversized tiles are cut into row bands so idle workers can pick up a part of them
+	void GraphicsDevice::render_tiles()
+	{
+		size_t thread_count = multi_thread ? jobs->worker_count() + 1 : 1;
+		if (multi_thread)
+		{
+			jobs->parallel_for(tile_length, tile_task_size, [this](size_t start, size_t end)
+			{
+				for (size_t tidx = start; tidx < end; tidx++)
+				{
+					prepare_tile(tiles[tidx]);
+				}
+			});
+		}
+		else
+		{
+			for (uint32_t tidx = 0; tidx < tile_length; tidx++)
+			{
+				prepare_tile(tiles[tidx]);
+			}
+		}
+
+		build_regions(thread_count);
+
+		if (multi_thread)
+		{
+			// one long running job per thread pulling regions in order, so the order is kept while idle threads still take over.
+			// owners drain their own group first and then help the others, threads owning nothing start with the first group
+			size_t groups = region_offsets.size() - 1;
+			assert(next_region.size() == groups);
+			for (size_t group = 0; group < groups; group++)
+			{
+				next_region[group] = region_offsets[group];
+			}
+			std::atomic<uint64_t> busy_time(0);
+			auto start_time = std::chrono::steady_clock::now();
+			jobs->parallel_for(thread_count, 1, [this, groups, &busy_time](size_t start, size_t end)
+			{
+				size_t own = jobs->thread_index() < groups ? jobs->thread_index() : 0;
+				for (size_t job = start; job < end; job++)
+				{
+					auto job_start = std::chrono::steady_clock::now();
+					for (size_t offset = 0; offset < groups; offset++)
+					{
+						size_t group = (own + offset) % groups;
+						for (size_t ridx = next_region[group].fetch_add(1); ridx < region_offsets[group + 1]; ridx = next_region[group].fetch_add(1))
+						{
+							rasterize_region(regions[ridx]);
+						}
+					}
+					busy_time += (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - job_start).count();
+				}
+			});
+			uint64_t wall_time = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+			uint64_t total_time = wall_time * thread_count;
+			thread_statistics().worker_idle_time += (float)(total_time - std::min(total_time, busy_time.load())) / 1e+3f;
+		}
+		else
+		{
+			for (size_t ridx = 0; ridx < regions.size(); ridx++)
+			{
+				rasterize_region(regions[ridx]);
+			}
+		}
+
+		for (uint32_t tidx = 0; tidx < tile_length; tidx++)
+		{
+			finish_tile(tiles[tidx]);
+		}
+		// every recorded clear has been applied by a region
+		lazy_clear = false;
+	}
+
+	// merges the bins and estimates the cost as a fixed setup cost per triangle plus the covered bounding box area,
+	// a recorded clear adds a fraction of the tile area
+	void GraphicsDevice::prepare_tile(FrameTile& tile)
 	{
-		if (multi_thread)
+		tile.merge_tasks(rendering_frame->binners, rendering_frame->binners_in_use);
+		uint64_t cost = 0;
+		for (size_t tidx = 0; tidx < tile.tasks.size(); tidx++)
+		{
+			const TriangleSetup& setup = binned_triangle(tile.tasks[tidx]).setup;
+			int rows = std::min(setup.row_end, (int)tile.row_end) - std::max(setup.row_start, (int)tile.row_start);
+			int cols = std::min(setup.col_end, (int)tile.col_end) - std::max(setup.col_start, (int)tile.col_start);
+			cost += TILE_TRIANGLE_COST + (uint64_t)std::max(rows, 0) * (uint64_t)std::max(cols, 0);
+		}
+		if (tile.clear_flag != BufferFlag::NONE)
+		{
+			cost += ((uint64_t)(tile.row_end - tile.row_start) * (tile.col_end - tile.col_start)) >> TILE_CLEAR_COST_SHIFT;
+		}
+		tile.cost = cost;
+	}
+
+	void GraphicsDevice::build_regions(const size_t& thread_count)
+	{
+		uint64_t total_cost = 0;
+		for (uint32_t tidx = 0; tidx < tile_length; tidx++)
+		{
+			total_cost += tiles[tidx].cost;
+		}
+		// a tile worth more than a fraction of one thread's share of the frame is split
+		uint64_t split_cost = thread_count > 1 ? std::max((uint64_t)1, total_cost / (thread_count * TILE_SPLIT_FACTOR)) : UINT64_MAX;
+
+		regions.clear();
+		for (uint32_t tidx = 0; tidx < tile_length; tidx++)
 		{
-			auto thread_size = (size_t)std::thread::hardware_concurrency();
-			ThreadPool tp(thread_size);
-			int task_size = TILE_TASK_SIZE;
-			int task_rest = tile_length % task_size;
-			int task_count = tile_length / task_size;
-			for (auto tid = 0; tid < task_count; tid++)
+			const FrameTile& tile = tiles[tidx];
+			if (tile.tasks.empty())
 			{
-				int start = tid * task_size;
-				int end = (static_cast<long>(tid) + 1) * task_size;
-				tp.enqueue([=]
+				// untouched tiles with a recorded clear become clear only regions, filled with streaming stores
+				if (tile.clear_flag == BufferFlag::NONE)
 				{
-					rasterize_tiles(start, end);
-				});
+					continue;
+				}
+				thread_statistics().fast_cleared_tile_count++;
 			}
-			int last_start = task_count * task_size;
-			int last_end = last_start + task_rest;
-			tp.enqueue([=]
+			// bands are whole hiz blocks high, so no block or quad is shared by two bands
+			uint32_t block_rows = (tile.row_end - tile.row_start + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+			uint32_t bands = (uint32_t)std::min((uint64_t)block_rows, tile.cost / split_cost + 1);
+			if (bands > 1)
 			{
-				rasterize_tiles(last_start, last_end);
-			});
-		}
-		else
-		{
-			for (uint32_t tidx = 0; tidx < tile_length; tidx++)
+				thread_statistics().split_tile_count++;
+			}
+			for (uint32_t band = 0; band < bands; band++)
 			{
-				rasterize_tile(tiles[tidx]);
+				TileRegion region;
+				region.tile_idx = tidx;
+				region.row_start = tile.row_start + block_rows * band / bands * HIZ_BLOCK_SIZE;
+				region.row_end = std::min(tile.row_end, tile.row_start + block_rows * (band + 1) / bands * HIZ_BLOCK_SIZE);
+				region.col_start = tile.col_start;
+				region.col_end = tile.col_end;
+				region.cost = tile.cost / bands;
+				region.clear_flag = tile.clear_flag;
+				assert(regions.size() < regions.capacity());
+				regions.push_back(region);
 			}
 		}
-	}
-
-	void GraphicsDevice::rasterize_tiles(const size_t& start, const size_t& end)
-	{
-		assert(end >= start);
-		for (auto idx = start; idx < end; idx++)
+		std::sort(regions.begin(), regions.end(), [this](const TileRegion& lhs, const TileRegion& rhs)
+		{
+			uint32_t lhs_owner = tiles[lhs.tile_idx].owner;
+			uint32_t rhs_owner = tiles[rhs.tile_idx].owner;
+			return lhs_owner != rhs_owner ? lhs_owner < rhs_owner : lhs.cost > rhs.cost;
+		});
+		size_t groups = std::max((size_t)1, owner_count());
+		region_offsets.assign(groups + 1, regions.size());
+		for (size_t ridx = regions.size(); ridx > 0; ridx--)
 		{
-			rasterize_tile(tiles[idx]);
+			region_offsets[tiles[regions[ridx - 1].tile_idx].owner] = ridx - 1;
 		}
+		for (size_t group = groups; group > 0; group--)
+		{
+			region_offsets[group - 1] = std::min(region_offsets[group - 1], region_offsets[group]);
+		}
+		thread_statistics().tile_region_count += (uint32_t)regions.size();
 	}
 
-	void GraphicsDevice::rasterize_tile(FrameTile& tile)
+	void GraphicsDevice::rasterize_region(const TileRegion& region)
 	{
-		while (!tile.tasks.empty())
+		const MiscParameter& params = *frame_params;
+		const FrameTile& tile = tiles[region.tile_idx];
+		// pixels about to be rasterized are cleared with plain stores, so they are already in the cache
+		clear_region(region.clear_flag, region.row_start, region.row_end, region.col_start, region.col_end, tile.tasks.empty());
+		bool resolve_pending = false;
+		for (size_t tidx = 0; tidx < tile.tasks.size(); tidx++)
 		{
-			TileTask task;
-			if (tile.pop_task(task))
+			const BinnedTriangle& binned = binned_triangle(tile.tasks[tidx]);
 			{
-				auto tri = task.triangle;
-				auto shader = task.shader;
+				const Vector4* positions = binned.positions;
+				auto shader = binned.shader;
+				uint32_t triangle_id = binned.deferred ? tile.tasks[tidx] : INVALID_TRIANGLE_ID;
+
+				// forward triangles may blend with or overwrite deferred pixels, so those are shaded first
+				if (triangle_id != INVALID_TRIANGLE_ID)
+				{
+					resolve_pending = true;
+				}
+				else if (resolve_pending)
+				{
+					resolve_tile(region);
+					resolve_pending = false;
+				}
 
-				RawBuffer<float>* zbuf = shader->shadow ? shadowmap.get() : zbuffer.get();
-				execute_task(framebuffer.get(), zbuf, stencilbuffer.get(), tile, tri, shader);
+				DepthStencilBuffer* zbuf = shader->shadow ? shadowmap.get() : zbuffer.get();
+				execute_task(framebuffer.get(), zbuf, region, binned, triangle_id);
 
-				// wireframe
-				if ((misc_param.render_flag & RenderFlag::WIREFRAME) != RenderFlag::DISABLE)
+				// wireframe, every region only draws its own pixels of the edges
+				if ((params.render_flag & RenderFlag::WIREFRAME) != RenderFlag::DISABLE)
 				{
-					draw_screen_segment(tri[0].position, tri[1].position, Color(0.5f, 0.5f, 1.0f, 1.0f));
-					draw_screen_segment(tri[0].position, tri[2].position, Color(0.5f, 0.5f, 1.0f, 1.0f));
-					draw_screen_segment(tri[2].position, tri[1].position, Color(0.5f, 0.5f, 1.0f, 1.0f));
+					draw_screen_segment(positions[0], positions[1], Color(0.5f, 0.5f, 1.0f, 1.0f), region);
+					draw_screen_segment(positions[0], positions[2], Color(0.5f, 0.5f, 1.0f, 1.0f), region);
+					draw_screen_segment(positions[2], positions[1], Color(0.5f, 0.5f, 1.0f, 1.0f), region);
 				}
 
-				if (tri.culled && ((misc_param.render_flag & RenderFlag::CULLED_BACK_FACE) != RenderFlag::DISABLE))
+				if (binned.culled && ((params.render_flag & RenderFlag::CULLED_BACK_FACE) != RenderFlag::DISABLE))
 				{
-					statistics.culled_backface_triangle_count++;
-					draw_screen_segment(tri[0].position, tri[1].position, Color(0.0f, 1.0f, 0.0f, 1.0f));
-					draw_screen_segment(tri[0].position, tri[2].position, Color(0.0f, 1.0f, 0.0f, 1.0f));
-					draw_screen_segment(tri[2].position, tri[1].position, Color(0.0f, 1.0f, 0.0f, 1.0f));
+					thread_statistics().culled_backface_triangle_count++;
+					draw_screen_segment(positions[0], positions[1], Color(0.0f, 1.0f, 0.0f, 1.0f), region);
+					draw_screen_segment(positions[0], positions[2], Color(0.0f, 1.0f, 0.0f, 1.0f), region);
+					draw_screen_segment(positions[2], positions[1], Color(0.0f, 1.0f, 0.0f, 1.0f), region);
 				}
 			}
 		}
-		if ((misc_param.render_flag & RenderFlag::FRAME_TILE) != RenderFlag::DISABLE)
+		if (resolve_pending)
+		{
+			resolve_tile(region);
+		}
+	}
+
+	// runs once every region of the tile is done
+	void GraphicsDevice::finish_tile(FrameTile& tile)
+	{
+		const MiscParameter& params = *frame_params;
+		tile.clear_flag = BufferFlag::NONE;
+		if (!tile.tasks.empty())
+		{
+			tile.clear();
+			tile.max_z = hiz_max(tile.row_start, tile.row_end, tile.col_start, tile.col_end);
+		}
+		tile.cost = 0;
+		if ((params.render_flag & RenderFlag::FRAME_TILE) != RenderFlag::DISABLE)
 		{
 			for (uint32_t row = tile.row_start; row < tile.row_end; row++)
 			{
@@ -365,43 +1379,231 @@ namespace Guarneri
 		}
 	}
 
-	void GraphicsDevice::execute_task(RawBuffer<color_bgra>* fbuf, RawBuffer<float>* zbuf, RawBuffer<uint8_t>* stencilbuf, const FrameTile& tile, const Triangle& tri, Shader* shader)
+	void GraphicsDevice::execute_task(RawBuffer<color_bgra>* fbuf, DepthStencilBuffer* zbuf, const TileRegion& region, const BinnedTriangle& binned, const uint32_t& triangle_id)
+	{
+		const TriangleSetup& setup = binned.setup;
+		int row_start = CLAMP_INT(setup.row_start, region.row_start, region.row_end);
+		int row_end = CLAMP_INT(setup.row_end, region.row_start, region.row_end);
+		int col_start = CLAMP_INT(setup.col_start, region.col_start, region.col_end);
+		int col_end = CLAMP_INT(setup.col_end, region.col_start, region.col_end);
+		traverse(fbuf, zbuf, setup, row_start, row_end, col_start, col_end, binned.shader, triangle_id);
+	}
+
+	const BinnedTriangle& GraphicsDevice::binned_triangle(const uint32_t& index) const
 	{
-		auto bounds = BoundingBox2D(tri[0].position, tri[1].position, tri[2].position);
-		int row_start = (int)(bounds.min().y + 0.5f) - 1;
-		int row_end = (int)(bounds.max().y + 0.5f) + 1;
-		int col_start = (int)(bounds.min().x + 0.5f) - 1;
-		int col_end = (int)(bounds.max().x + 0.5f) + 1;
+		return rendering_frame->binners[index >> BINNED_TRIANGLE_BITS]->triangles[index & BINNED_TRIANGLE_MASK];
+	}
 
-		row_start = CLAMP_INT(row_start, tile.row_start, tile.row_end);
-		row_end = CLAMP_INT(row_end, tile.row_start, tile.row_end);
-		col_start = CLAMP_INT(col_start, tile.col_start, tile.col_end);
-		col_end = CLAMP_INT(col_end, tile.col_start, tile.col_end);
+	// shades every pixel of the region that holds a deferred triangle, then empties it
+	void GraphicsDevice::resolve_tile(const TileRegion& tile)
+	{
+		const VisibilitySample empty = { INVALID_TRIANGLE_ID, 0.0f, 0.0f };
 
-		bool flip = tri.flip;
-		int ccw_idx0 = 0;
-		int ccw_idx1 = flip ? 2 : 1;
-		int ccw_idx2 = flip ? 1 : 2;
+		// regions start at even rows and columns, so quads never straddle two regions
+		for (uint32_t row = tile.row_start; row < tile.row_end; row += 2)
+		{
+			for (uint32_t col = tile.col_start; col < tile.col_end; col += 2)
+			{
+				VisibilitySample samples[4];
+				uint32_t quad_mask = 0;
+				for (uint32_t k = 0; k < 4; k++)
+				{
+					uint32_t r = row + (k >> 1);
+					uint32_t c = col + (k & 1);
+					if (r >= tile.row_end || c >= tile.col_end)
+					{
+						continue;
+					}
+					samples[k] = visibilitybuffer->at(r, c);
+					if (samples[k].triangle_id != INVALID_TRIANGLE_ID)
+					{
+						quad_mask |= 1u << k;
+					}
+				}
+
+				// derivatives come from the quad of the triangle that owns the pixel, as in traverse_pixels
+				uint32_t quad_id = INVALID_TRIANGLE_ID;
+				v2f_attributes ddx, ddy;
+				for (uint32_t k = 0; k < 4; k++)
+				{
+					if ((quad_mask & (1u << k)) == 0)
+					{
+						continue;
+					}
+					const VisibilitySample& sample = samples[k];
+					const BinnedTriangle& deferred = binned_triangle(sample.triangle_id);
+					const TriangleSetup& setup = deferred.setup;
+					if (sample.triangle_id != quad_id && setup.planes.varyings != Varying::NONE)
+					{
+						v2f quad[3];
+						for (int h = 0; h < 3; h++)
+						{
+							float hw1, hw2;
+							setup.barycentric((int)row + (h >> 1), (int)col + (h & 1), hw1, hw2);
+							setup.planes.evaluate(hw1, hw2, quad[h]);
+						}
+						ddx = VaryingPlanes::derivative(quad[0], quad[1]);
+						ddy = VaryingPlanes::derivative(quad[0], quad[2]);
+						quad_id = sample.triangle_id;
+					}
+
+					uint32_t r = row + (k >> 1);
+					uint32_t c = col + (k & 1);
+					v2f frag;
+					setup.planes.evaluate(sample.w1, sample.w2, frag);
+					frag.ddx = ddx;
+					frag.ddy = ddy;
+					frag.position.z = zbuffer->load_depth(r, c);
+					Color fragment_result = deferred.shader->fragment_shader(frag);
+					thread_statistics().shaded_fragment_count++;
+					framebuffer->at(r, c) = Color::encode_bgra(fragment_result);
+					visibilitybuffer->at(r, c) = empty;
+				}
+			}
+		}
+	}
+
+	// triangles whose per-sample state reduces to "nearest surface wins" can be shaded after visibility is known
+	bool GraphicsDevice::deferrable(const Shader* shader) const
+	{
+		if (!visibility_buffer || !tile_based)
+		{
+			return false;
+		}
+		if (shader->transparent || shader->shadow || shader->skybox)
+		{
+			return false;
+		}
+		bool enable_alpha_test = (misc_param.persample_op_flag & PerSampleOperation::ALPHA_TEST) != PerSampleOperation::DISABLE;
+		bool enable_depth_test = (misc_param.persample_op_flag & PerSampleOperation::DEPTH_TEST) != PerSampleOperation::DISABLE;
+		if (enable_alpha_test || !enable_depth_test)
+		{
+			return false;
+		}
+		if ((shader->ztest_func != CompareFunc::LESS && shader->ztest_func != CompareFunc::LEQUAL) || shader->zwrite_mode != ZWrite::ON)
+		{
+			return false;
+		}
+		if (shader->color_mask != (ColorMask::R | ColorMask::G | ColorMask::B | ColorMask::A))
+		{
+			return false;
+		}
+		if (shader->stencil_func != CompareFunc::ALWAYS || shader->stencil_pass_op != StencilOp::KEEP || shader->stencil_fail_op != StencilOp::KEEP || shader->stencil_zfail_op != StencilOp::KEEP)
+		{
+			return false;
+		}
+		// debug views write per fragment
+		RenderFlag forward_flags = RenderFlag::WIREFRAME | RenderFlag::DEPTH | RenderFlag::SHADOWMAP | RenderFlag::STENCIL | RenderFlag::EARLY_Z_DEBUG | RenderFlag::CULLED_BACK_FACE;
+		return (misc_param.render_flag & forward_flags) == RenderFlag::DISABLE;
+	}
+
+	// occlusion against hierarchical z is only exact when a fragment behind the stored depth has no side effects
+	bool GraphicsDevice::hiz_enabled(const Shader* shader, const MiscParameter& params) const
+	{
+		if ((params.culling_clipping_flag & CullingAndClippingFlag::HIZ_CULLING) == CullingAndClippingFlag::DISABLE)
+		{
+			return false;
+		}
+		// shadow casters write the shadowmap, which has no hierarchical z
+		if (shader->shadow)
+		{
+			return false;
+		}
+		bool enable_alpha_test = (params.persample_op_flag & PerSampleOperation::ALPHA_TEST) != PerSampleOperation::DISABLE;
+		bool enable_depth_test = (params.persample_op_flag & PerSampleOperation::DEPTH_TEST) != PerSampleOperation::DISABLE;
+		bool early_z_debug = (params.render_flag & RenderFlag::EARLY_Z_DEBUG) != RenderFlag::DISABLE;
+		if (!enable_depth_test || enable_alpha_test || early_z_debug)
+		{
+			return false;
+		}
+		// a fragment behind every stored depth can not be equal to it either
+		return shader->ztest_func == CompareFunc::LESS || shader->ztest_func == CompareFunc::LEQUAL || shader->ztest_func == CompareFunc::EQUAL;
+	}
 
-		auto v0 = tri[ccw_idx0].position.xy();
-		auto v1 = tri[ccw_idx1].position.xy();
-		auto v2 = tri[ccw_idx2].position.xy();
+	// farthest stored depth over the hierarchical z blocks overlapping [row_start, row_end) x [col_start, col_end)
+	float GraphicsDevice::hiz_max(const int& row_start, const int& row_end, const int& col_start, const int& col_end) const
+	{
+		float depth = -FLT_MAX;
+		for (uint32_t block_row = row_start / HIZ_BLOCK_SIZE; block_row <= (uint32_t)(row_end - 1) / HIZ_BLOCK_SIZE; block_row++)
+		{
+			for (uint32_t block_col = col_start / HIZ_BLOCK_SIZE; block_col <= (uint32_t)(col_end - 1) / HIZ_BLOCK_SIZE; block_col++)
+			{
+				float block_depth;
+				if (hizbuffer->read(block_row, block_col, block_depth))
+				{
+					depth = std::max(depth, block_depth);
+				}
+			}
+		}
+		return depth;
+	}
 
-		float area = Triangle::area_double(v0, v1, v2);
+	// recomputes the hierarchical z blocks overlapping [row_start, row_end) x [col_start, col_end) from zbuffer
+	void GraphicsDevice::update_hiz(const int& row_start, const int& row_end, const int& col_start, const int& col_end)
+	{
+		for (uint32_t block_row = row_start / HIZ_BLOCK_SIZE; block_row <= (uint32_t)(row_end - 1) / HIZ_BLOCK_SIZE; block_row++)
+		{
+			uint32_t pixel_row_end = std::min((block_row + 1) * HIZ_BLOCK_SIZE, this->height);
+			for (uint32_t block_col = col_start / HIZ_BLOCK_SIZE; block_col <= (uint32_t)(col_end - 1) / HIZ_BLOCK_SIZE; block_col++)
+			{
+				uint32_t pixel_col_start = block_col * HIZ_BLOCK_SIZE;
+				uint32_t pixel_col_end = std::min(pixel_col_start + HIZ_BLOCK_SIZE, this->width);
+				float depth = -FLT_MAX;
+				for (uint32_t row = block_row * HIZ_BLOCK_SIZE; row < pixel_row_end; row++)
+				{
+					for (uint32_t col = pixel_col_start; col < pixel_col_end;)
+					{
+						// a whole block row at once unless the layout is morton, unorm formats are decoded one by one
+						uint32_t count = std::min(zbuffer->span_length(row, col), pixel_col_end - col);
+						if (count == 0)
+						{
+							depth = std::max(depth, zbuffer->load_depth(row, col));
+							col++;
+							continue;
+						}
+						const float* zrow = zbuffer->get_ptr(row, col);
+						for (uint32_t idx = 0; idx < count; idx++)
+						{
+							depth = std::max(depth, zrow[idx]);
+						}
+						col += count;
+					}
+				}
+				hizbuffer->at(block_row, block_col) = depth;
+			}
+		}
+	}
 
-		for (int row = row_start; row < row_end; row++)
+	// depth written outside the tiles is not tracked per pixel, blocks that may now hold a farther depth than max_z
+	// stop rejecting until their tile recomputes them. only constants are stored, draws may run concurrently
+	void GraphicsDevice::invalidate_hiz(const int& row_start, const int& row_end, const int& col_start, const int& col_end, const float& max_z)
+	{
+		if (row_start >= row_end || col_start >= col_end)
+		{
+			return;
+		}
+		for (uint32_t block_row = row_start / HIZ_BLOCK_SIZE; block_row <= (uint32_t)(row_end - 1) / HIZ_BLOCK_SIZE; block_row++)
+		{
+			for (uint32_t block_col = col_start / HIZ_BLOCK_SIZE; block_col <= (uint32_t)(col_end - 1) / HIZ_BLOCK_SIZE; block_col++)
+			{
+				float block_depth;
+				if (hizbuffer->read(block_row, block_col, block_depth) && max_z > block_depth)
+				{
+					hizbuffer->write(block_row, block_col, FLT_MAX);
+				}
+			}
+		}
+		int tile_row_start, tile_row_end, tile_col_start, tile_col_end;
+		FrameTile::pixel2tile(row_start, col_start, tile_row_start, tile_col_start, tile_width, tile_height);
+		FrameTile::pixel2tile(row_end - 1, col_end - 1, tile_row_end, tile_col_end, tile_width, tile_height);
+		for (int row = tile_row_start; row <= tile_row_end; row++)
 		{
-			for (int col = col_start; col < col_end; col++)
+			for (int col = tile_col_start; col <= tile_col_end; col++)
 			{
-				Vector2 pixel((float)col + 0.5f, (float)row + 0.5f);
-				float w0 = Triangle::area_double(v1, v2, pixel);
-				float w1 = Triangle::area_double(v2, v0, pixel);
-				float w2 = Triangle::area_double(v0, v1, pixel);
-				if (w0 >= 0 && w1 >= 0 && w2 >= 0)
+				FrameTile& tile = tiles[FrameTile::coord2index(row, col, col_tile_count)];
+				if (max_z > tile.max_z)
 				{
-					w0 /= area; w1 /= area; w2 /= area;
-					Vertex vert = Vertex::barycentric_interpolate(tri[ccw_idx0], tri[ccw_idx1], tri[ccw_idx2], w0, w1, w2);
-					process_fragment(fbuf, zbuf, stencilbuf, vert, row, col, shader);
+					tile.max_z = FLT_MAX;
 				}
 			}
 		}
@@ -417,6 +1619,19 @@ namespace Guarneri
 		{
 			scanline(tri, shader);
 		}
+		if (!shader->shadow && shader->zwrite_mode == ZWrite::ON)
+		{
+			float min_x = std::min(tri[0].position.x, std::min(tri[1].position.x, tri[2].position.x));
+			float max_x = std::max(tri[0].position.x, std::max(tri[1].position.x, tri[2].position.x));
+			float min_y = std::min(tri[0].position.y, std::min(tri[1].position.y, tri[2].position.y));
+			float max_y = std::max(tri[0].position.y, std::max(tri[1].position.y, tri[2].position.y));
+			int row_start = CLAMP_INT((int)std::floor(min_y), 0, this->height);
+			int row_end = CLAMP_INT((int)std::ceil(max_y) + 1, 0, this->height);
+			int col_start = CLAMP_INT((int)std::floor(min_x), 0, this->width);
+			int col_end = CLAMP_INT((int)std::ceil(max_x) + 1, 0, this->width);
+			float max_z = std::max(tri[0].position.z, std::max(tri[1].position.z, tri[2].position.z));
+			invalidate_hiz(row_start, row_end, col_start, col_end, max_z);
+		}
 		// wireframe
 		if ((misc_param.render_flag & RenderFlag::WIREFRAME) != RenderFlag::DISABLE)
 		{
@@ -428,46 +1643,230 @@ namespace Guarneri
 
 	void GraphicsDevice::scanblock(const Triangle& tri, Shader* shader)
 	{
-		auto bounds = BoundingBox2D(tri[0].position, tri[1].position, tri[2].position);
-		int row_start = (int)(bounds.min().y + 0.5f) - 1;
-		int row_end = (int)(bounds.max().y + 0.5f) + 1;
-		int col_start = (int)(bounds.min().x + 0.5f) - 1;
-		int col_end = (int)(bounds.max().x + 0.5f) + 1;
+		TriangleSetup setup;
+		if (!setup.initialize(tri, shader->varyings))
+		{
+			return;
+		}
+		int row_start = CLAMP_INT(setup.row_start, 0, this->height);
+		int row_end = CLAMP_INT(setup.row_end, 0, this->height);
+		int col_start = CLAMP_INT(setup.col_start, 0, this->width);
+		int col_end = CLAMP_INT(setup.col_end, 0, this->width);
+		DepthStencilBuffer* zbuf = shader->shadow ? shadowmap.get() : zbuffer.get();
+		traverse(framebuffer.get(), zbuf, setup, row_start, row_end, col_start, col_end, shader, INVALID_TRIANGLE_ID);
+	}
 
-		row_start = CLAMP_INT(row_start, 0, this->height);
-		row_end = CLAMP_INT(row_end, 0, this->height);
-		col_start = CLAMP_INT(col_start, 0, this->width);
-		col_end = CLAMP_INT(col_end, 0, this->width);
+	// coarse pass over [row_start, row_end) x [col_start, col_end), blocks are aligned to the screen
+	void GraphicsDevice::traverse(RawBuffer<color_bgra>* fbuf, DepthStencilBuffer* zbuf, const TriangleSetup& setup, const int& row_start, const int& row_end, const int& col_start, const int& col_end, Shader* shader, const uint32_t& triangle_id)
+	{
+		const MiscParameter& params = *frame_params;
+		if (row_start >= row_end || col_start >= col_end)
+		{
+			return;
+		}
 
-		bool flip = tri.flip;
-		int ccw_idx0 = 0;
-		int ccw_idx1 = flip ? 2 : 1;
-		int ccw_idx2 = flip ? 1 : 2;
+		// hierarchical z is only maintained by tiles, which own their blocks exclusively
+		bool hiz_test = hiz_enabled(shader, params);
+		bool hiz_update = tile_based && !shader->shadow;
 
-		auto v0 = tri[ccw_idx0].position.xy();
-		auto v1 = tri[ccw_idx1].position.xy();
-		auto v2 = tri[ccw_idx2].position.xy();
+		int block_size = (int)params.raster_block_size;
+		if (block_size <= 1)
+		{
+			if (hiz_test && setup.min_depth(row_start, row_end, col_start, col_end) - HIZ_EPSILON > hiz_max(row_start, row_end, col_start, col_end))
+			{
+				thread_statistics().hiz_block_optimized++;
+				return;
+			}
+			if (traverse_pixels(fbuf, zbuf, setup, row_start, row_end, col_start, col_end, false, shader, triangle_id) && hiz_update)
+			{
+				update_hiz(row_start, row_end, col_start, col_end);
+			}
+			return;
+		}
 
-		float area = Triangle::area_double(v0, v1, v2);
-		float inv_area = 1.0f / area;
+		for (int block_row = row_start; block_row < row_end;)
+		{
+			int block_row_end = std::min((block_row / block_size + 1) * block_size, row_end);
+			for (int block_col = col_start; block_col < col_end;)
+			{
+				int block_col_end = std::min((block_col / block_size + 1) * block_size, col_end);
+				BlockCoverage coverage = setup.classify_block(block_row, block_row_end, block_col, block_col_end);
+				if (coverage != BlockCoverage::OUTSIDE)
+				{
+					if (hiz_test && setup.min_depth(block_row, block_row_end, block_col, block_col_end) - HIZ_EPSILON > hiz_max(block_row, block_row_end, block_col, block_col_end))
+					{
+						thread_statistics().hiz_block_optimized++;
+					}
+					else if (traverse_pixels(fbuf, zbuf, setup, block_row, block_row_end, block_col, block_col_end, coverage == BlockCoverage::INSIDE, shader, triangle_id) && hiz_update)
+					{
+						update_hiz(block_row, block_row_end, block_col, block_col_end);
+					}
+				}
+				block_col = block_col_end;
+			}
+			block_row = block_row_end;
+		}
+	}
 
-		for (uint32_t row = row_start; row < (uint32_t)row_end; row++)
+	// walks the edge functions incrementally over [row_start, row_end) x [col_start, col_end) in spans,
+	// coverage and early depth rejection of a span are evaluated at once by RasterKernel,
+	// returns whether any pixel survived
+	bool GraphicsDevice::traverse_pixels(RawBuffer<color_bgra>* fbuf, DepthStencilBuffer* zbuf, const TriangleSetup& setup, const int& row_start, const int& row_end, const int& col_start, const int& col_end, const bool& inside, Shader* shader, const uint32_t& triangle_id)
+	{
+		const MiscParameter& params = *frame_params;
+		const EdgeFunction& e0 = setup.edges[0];
+		const EdgeFunction& e1 = setup.edges[1];
+		const EdgeFunction& e2 = setup.edges[2];
+
+		bool enable_alpha_test = (params.persample_op_flag & PerSampleOperation::ALPHA_TEST) != PerSampleOperation::DISABLE;
+		bool enable_depth_test = (params.persample_op_flag & PerSampleOperation::DEPTH_TEST) != PerSampleOperation::DISABLE;
+		bool early_z_debug = (params.render_flag & RenderFlag::EARLY_Z_DEBUG) != RenderFlag::DISABLE;
+		// same conditions as the early-z in process_fragment
+		bool early_z = enable_depth_test && !enable_alpha_test && !early_z_debug;
+		// nothing but depth reaches the buffers, fragments are not shaded at all.
+		// the kernel leaves EQUAL to the per sample test, so it can not be trusted here
+		bool enable_stencil_test = (params.persample_op_flag & PerSampleOperation::STENCIL_TEST) != PerSampleOperation::DISABLE;
+		bool default_stencil = !enable_stencil_test || (shader->stencil_pass_op == StencilOp::KEEP && shader->stencil_fail_op == StencilOp::KEEP && shader->stencil_zfail_op == StencilOp::KEEP && shader->stencil_func == CompareFunc::ALWAYS);
+		bool debug_views = (params.render_flag & (RenderFlag::DEPTH | RenderFlag::STENCIL | RenderFlag::SHADOWMAP)) != RenderFlag::DISABLE;
+		bool depth_only = early_z && shader->ztest_func != CompareFunc::EQUAL && shader->color_mask == ColorMask::ZERO && shader->zwrite_mode == ZWrite::ON && default_stencil && !debug_views;
+		// spans crossing a block of a blocked zbuffer or of a unorm format read their depth through this copy
+		float span_depth[RASTER_SPAN_WIDTH];
+
+		RasterSpan span;
+		span.bias[0] = e0.bias;
+		span.bias[1] = e1.bias;
+		span.bias[2] = e2.bias;
+		span.step[0] = e0.step_x;
+		span.step[1] = e1.step_x;
+		span.step[2] = e2.step_x;
+		span.inv_area = setup.inv_area;
+		span.z[0] = setup.z[0];
+		span.z[1] = setup.z[1];
+		span.z[2] = setup.z[2];
+		span.inside = inside;
+		span.fits_simd = setup.fits_simd;
+		span.ztest_func = shader->ztest_func;
+		RasterSpanResult result;
+
+		// helper pixels are only needed if there are varyings to differentiate
+		bool need_helpers = setup.planes.varyings != Varying::NONE;
+		bool any_live = false;
+		uint32_t live[2];
+		float z[2][RASTER_SPAN_WIDTH];
+		float w1[2][RASTER_SPAN_WIDTH];
+		float w2[2][RASTER_SPAN_WIDTH];
+
+		// pixels are walked in 2x2 quads aligned to even rows and columns,
+		// lanes outside [row_start, row_end) x [col_start, col_end) only act as helpers
+		for (int row = row_start & ~1; row < row_end; row += 2)
 		{
-			for (uint32_t col = col_start; col < (uint32_t)col_end; col++)
+			for (int col = col_start & ~1; col < col_end; col += RASTER_SPAN_WIDTH)
 			{
-				Vector2 pixel((float)col + 0.5f, (float)row + 0.5f);
-				float w0 = Triangle::area_double(v1, v2, pixel);
-				float w1 = Triangle::area_double(v2, v0, pixel);
-				float w2 = Triangle::area_double(v0, v1, pixel);
-				if (w0 >= 0 && w1 >= 0 && w2 >= 0)
+				int count = std::min(RASTER_SPAN_WIDTH, col_end - col);
+				uint32_t region_mask = ((1u << count) - 1) & (col < col_start ? ~1u : ~0u);
+				for (int r = 0; r < 2; r++)
+				{
+					live[r] = 0;
+					int y = row + r;
+					if (y < row_start || y >= row_end)
+					{
+						continue;
+					}
+					// sample at pixel centers
+					int64_t px = ((int64_t)col << SUBPIXEL_BITS) + SUBPIXEL_HALF;
+					int64_t py = ((int64_t)y << SUBPIXEL_BITS) + SUBPIXEL_HALF;
+					span.w[0] = e0.evaluate(px, py);
+					span.w[1] = e1.evaluate(px, py);
+					span.w[2] = e2.evaluate(px, py);
+					span.count = count;
+					span.depth = nullptr;
+					if (early_z && (int)zbuf->span_length((uint32_t)y, (uint32_t)col) >= count)
+					{
+						span.depth = zbuf->get_ptr((uint32_t)y, (uint32_t)col);
+					}
+					else if (early_z)
+					{
+						for (int i = 0; i < count; i++)
+						{
+							span_depth[i] = zbuf->load_depth((uint32_t)y, (uint32_t)(col + i));
+						}
+						span.depth = span_depth;
+					}
+					RasterKernel::evaluate(span, result);
+					thread_statistics().earlyz_optimized += RasterKernel::count_bits(result.coverage & ~result.mask & region_mask);
+					live[r] = result.mask & region_mask;
+					any_live = any_live || live[r] != 0;
+					std::copy(result.z, result.z + count, z[r]);
+					std::copy(result.w1, result.w1 + count, w1[r]);
+					std::copy(result.w2, result.w2 + count, w2[r]);
+				}
+
+				// live pixels already passed the depth test in the kernel, deferred triangles only record visibility
+				if (triangle_id != INVALID_TRIANGLE_ID || depth_only)
+				{
+					for (int r = 0; r < 2; r++)
+					{
+						for (int i = 0; i < count; i++)
+						{
+							if ((live[r] & (1u << i)) != 0)
+							{
+								zbuf->store((uint32_t)(row + r), (uint32_t)(col + i), z[r][i]);
+								if (triangle_id != INVALID_TRIANGLE_ID)
+								{
+									visibilitybuffer->at((uint32_t)(row + r), (uint32_t)(col + i)) = { triangle_id, w1[r][i], w2[r][i] };
+								}
+							}
+						}
+					}
+					continue;
+				}
+
+				for (int i = 0; i < count; i += 2)
 				{
-					w0 *= inv_area; w1 *= inv_area; w2 *= inv_area;
-					Vertex vert = Vertex::barycentric_interpolate(tri[ccw_idx0], tri[ccw_idx1], tri[ccw_idx2], w0, w1, w2);
-					RawBuffer<float>* zbuf = shader->shadow ? shadowmap.get() : zbuffer.get();
-					process_fragment(framebuffer.get(), zbuf, stencilbuffer.get(), vert, row, col, shader);
+					// bit 0, 1: bottom row, bit 2, 3: top row
+					uint32_t quad_mask = ((live[0] >> i) & 0x3) | (((live[1] >> i) & 0x3) << 2);
+					if (quad_mask == 0)
+					{
+						continue;
+					}
+
+					v2f quad[4];
+					for (int k = 0; k < 4; k++)
+					{
+						int r = k >> 1;
+						int c = i + (k & 1);
+						if ((quad_mask & (1u << k)) != 0)
+						{
+							setup.planes.evaluate(w1[r][c], w2[r][c], quad[k]);
+							quad[k].position.z = z[r][c];
+						}
+						else if (need_helpers)
+						{
+							float hw1, hw2;
+							setup.barycentric(row + r, col + c, hw1, hw2);
+							setup.planes.evaluate(hw1, hw2, quad[k]);
+						}
+					}
+
+					v2f_attributes ddx, ddy;
+					if (need_helpers)
+					{
+						ddx = VaryingPlanes::derivative(quad[0], quad[1]);
+						ddy = VaryingPlanes::derivative(quad[0], quad[2]);
+					}
+					for (int k = 0; k < 4; k++)
+					{
+						if ((quad_mask & (1u << k)) != 0)
+						{
+							quad[k].ddx = ddx;
+							quad[k].ddy = ddy;
+							process_fragment(fbuf, zbuf, quad[k], (uint32_t)(row + (k >> 1)), (uint32_t)(col + i + (k & 1)), shader);
+						}
+					}
 				}
 			}
 		}
+		return any_live;
 	}
 
 	void GraphicsDevice::scanline(const Triangle& tri, Shader* shader)
@@ -481,45 +1880,48 @@ namespace Guarneri
 		bottom = CLAMP_INT(bottom, 0, this->height);
 		assert(bottom >= top);
 
+		DepthStencilBuffer* zbuf = shader->shadow ? shadowmap.get() : zbuffer.get();
 		for (uint32_t row = top; row < (uint32_t)bottom; row++)
 		{
 			Vertex lhs, rhs;
 			tri.interpolate((float)row + 0.5f, lhs, rhs);
 
-			// screen space clipping
-			bool enable_screen_clipping = (misc_param.culling_clipping_flag & CullingAndClippingFlag::SCREEN_CLIPPING) != CullingAndClippingFlag::DISABLE;
-			if (enable_screen_clipping)
-			{
-				Clipper::screen_clipping(lhs, rhs, this->width);
-			}
 			int left = (int)(lhs.position.x + 0.5f);
 			left = CLAMP_INT(left, 0, this->width);
 			int right = (int)(rhs.position.x + 0.5f);
 			right = CLAMP_INT(right, 0, this->width);
-			assert(right >= left);
+			if (left >= right)
+			{
+				continue;
+			}
 
+			// spans inside the guard band are scissored, only the start is moved onto the viewport
+			if (lhs.position.x < 0.0f)
+			{
+				lhs = Vertex::interpolate(lhs, rhs, -lhs.position.x / (rhs.position.x - lhs.position.x));
+			}
+			auto dx = Vertex::differential(lhs, rhs);
 			for (uint32_t col = left; col < (uint32_t)right; col++)
 			{
-				RawBuffer<float>* zbuf = shader->shadow ? shadowmap.get() : zbuffer.get();
-				process_fragment(framebuffer.get(), zbuf, stencilbuffer.get(), lhs, row, col, shader);
-				auto dx = Vertex::differential(lhs, rhs);
+				process_fragment(framebuffer.get(), zbuf, fragment_input(lhs), row, col, shader);
 				lhs = Vertex::intagral(lhs, dx);
 			}
 		}
 	}
 
 	// per fragment processing
-	void GraphicsDevice::process_fragment(RawBuffer<color_bgra>* fbuf, RawBuffer<float>* zbuf, RawBuffer<uint8_t>* stencilbuf, const Vertex& v, const uint32_t& row, const uint32_t& col, Shader* shader)
+	void GraphicsDevice::process_fragment(RawBuffer<color_bgra>* fbuf, DepthStencilBuffer* zbuf, const v2f& v_out, const uint32_t& row, const uint32_t& col, Shader* shader)
 	{
-		bool enable_scissor_test = (misc_param.persample_op_flag & PerSampleOperation::SCISSOR_TEST) != PerSampleOperation::DISABLE;
-		bool enable_alpha_test = (misc_param.persample_op_flag & PerSampleOperation::ALPHA_TEST) != PerSampleOperation::DISABLE;
-		bool enable_stencil_test = (misc_param.persample_op_flag & PerSampleOperation::STENCIL_TEST) != PerSampleOperation::DISABLE;
-		bool enable_depth_test = (misc_param.persample_op_flag & PerSampleOperation::DEPTH_TEST) != PerSampleOperation::DISABLE;
+		const MiscParameter& params = *frame_params;
+		bool enable_scissor_test = (params.persample_op_flag & PerSampleOperation::SCISSOR_TEST) != PerSampleOperation::DISABLE;
+		bool enable_alpha_test = (params.persample_op_flag & PerSampleOperation::ALPHA_TEST) != PerSampleOperation::DISABLE;
+		bool enable_stencil_test = (params.persample_op_flag & PerSampleOperation::STENCIL_TEST) != PerSampleOperation::DISABLE;
+		bool enable_depth_test = (params.persample_op_flag & PerSampleOperation::DEPTH_TEST) != PerSampleOperation::DISABLE;
 
 		PerSampleOperation op_pass = PerSampleOperation::SCISSOR_TEST | PerSampleOperation::ALPHA_TEST | PerSampleOperation::STENCIL_TEST | PerSampleOperation::DEPTH_TEST;
 
 		auto s = shader;
-		float z = v.position.z;
+		float z = v_out.position.z;
 
 		ColorMask color_mask = s->color_mask;
 		CompareFunc stencil_func = s->stencil_func;
@@ -537,18 +1939,22 @@ namespace Guarneri
 
 		REF(stencil_write_mask);
 
-		bool enable_blending = (misc_param.persample_op_flag & PerSampleOperation::BLENDING) != PerSampleOperation::DISABLE && s->transparent;
+		bool enable_blending = (params.persample_op_flag & PerSampleOperation::BLENDING) != PerSampleOperation::DISABLE && s->transparent;
+
+		// depth and stencil are loaded once and stored once, a packed format keeps both in the same word.
+		// row and col were clamped to the target by the traversal, so neither is bounds checked again
+		DepthStencilSample sample = zbuf->load(row, col);
 
 		// early-z
 		// todo: early-z conditions
 		bool valid_early_z = false;
 		if (enable_depth_test && !enable_alpha_test)
 		{
-			if (!perform_depth_test(zbuf, ztest_func, row, col, z))
+			if (!perform_depth_test(ztest_func, z, sample.depth))
 			{
 				op_pass &= ~PerSampleOperation::DEPTH_TEST;
-				statistics.earlyz_optimized++;
-				if ((misc_param.render_flag & RenderFlag::EARLY_Z_DEBUG) == RenderFlag::DISABLE)
+				thread_statistics().earlyz_optimized++;
+				if ((params.render_flag & RenderFlag::EARLY_Z_DEBUG) == RenderFlag::DISABLE)
 				{
 					return;
 				}
@@ -565,19 +1971,8 @@ namespace Guarneri
 		Color fragment_result;
 		if (s != nullptr)
 		{
-			v2f v_out;
-			float w = 1.0f / v.rhw;
-			v_out.position = v.position;
-			v_out.world_pos = v.world_pos * w;
-			v_out.shadow_coord = v.shadow_coord * w;
-			v_out.color = v.color * w;
-			v_out.normal = v.normal * w;
-			v_out.uv = v.uv * w;
-			v_out.tangent = v.tangent * w;
-			v_out.bitangent = v.bitangent * w;
-
-			// todo: ddx ddy
 			fragment_result = s->fragment_shader(v_out);
+			thread_statistics().shaded_fragment_count++;
 			pixel_color = Color::encode_bgra(fragment_result);
 		}
 
@@ -598,7 +1993,7 @@ namespace Guarneri
 
 		if (enable_stencil_test)
 		{
-			if (!perform_stencil_test(stencilbuf, stencil_ref_val, stencil_read_mask, stencil_func, row, col))
+			if (!perform_stencil_test(stencil_ref_val, stencil_read_mask, stencil_func, sample.stencil))
 			{
 				op_pass &= ~PerSampleOperation::STENCIL_TEST;
 			}
@@ -607,32 +2002,37 @@ namespace Guarneri
 		// depth test
 		if (enable_depth_test)
 		{
-			if (!perform_depth_test(zbuf, ztest_func, row, col, z))
+			if (!perform_depth_test(ztest_func, z, sample.depth))
 			{
 				op_pass &= ~PerSampleOperation::DEPTH_TEST;
 			}
 		}
 
-		// write depth
+		// write depth and stencil, without zwrite only the stencil is stored so the depth bits are left untouched
+		if (enable_stencil_test)
+		{
+			sample.stencil = update_stencil(op_pass, stencil_pass_op, stencil_fail_op, stencil_zfail_op, stencil_ref_val, sample.stencil);
+		}
 		if (zwrite_mode == ZWrite::ON)
 		{
-			zbuf->write(row, col, z);
+			sample.depth = z;
+			zbuf->store(row, col, sample);
+		}
+		else if (enable_stencil_test)
+		{
+			zbuf->store_stencil(row, col, sample.stencil);
 		}
 
 		// blending
 		if (enable_blending && s != nullptr && s->transparent)
 		{
-			color_bgra dst;
-			if (fbuf->read(row, col, dst))
-			{
-				Color dst_color = Color::decode(dst);
-				Color src_color = fragment_result;
-				Color blended_color = blend(src_color, dst_color, src_factor, dst_factor, blend_op);
-				pixel_color = Color::encode_bgra(blended_color.r, blended_color.g, blended_color.b, blended_color.a);
-			}
+			Color dst_color = Color::decode(fbuf->at(row, col));
+			Color src_color = fragment_result;
+			Color blended_color = blend(src_color, dst_color, src_factor, dst_factor, blend_op);
+			pixel_color = Color::encode_bgra(blended_color.r, blended_color.g, blended_color.b, blended_color.a);
 		}
 
-		if ((misc_param.render_flag & RenderFlag::EARLY_Z_DEBUG) != RenderFlag::DISABLE)
+		if ((params.render_flag & RenderFlag::EARLY_Z_DEBUG) != RenderFlag::DISABLE)
 		{
 			if (valid_early_z)
 			{
@@ -664,48 +2064,35 @@ namespace Guarneri
 			// write color
 			if (validate_fragment(op_pass))
 			{
-				if (color_mask == (ColorMask::R | ColorMask::G | ColorMask::B | ColorMask::A))
+				color_bgra& cur = fbuf->at(row, col);
+				if (color_mask != (ColorMask::R | ColorMask::G | ColorMask::B | ColorMask::A))
 				{
-					fbuf->write(row, col, pixel_color);
-				}
-				else
-				{
-					color_bgra cur;
-					if (fbuf->read(row, col, cur))
+					if ((color_mask & ColorMask::R) == ColorMask::ZERO)
 					{
-						if ((color_mask & ColorMask::R) == ColorMask::ZERO)
-						{
-							pixel_color.r = cur.r;
-						}
-						if ((color_mask & ColorMask::G) == ColorMask::ZERO)
-						{
-							pixel_color.g = cur.g;
-						}
-						if ((color_mask & ColorMask::B) == ColorMask::ZERO)
-						{
-							pixel_color.b = cur.b;
-						}
-						if ((color_mask & ColorMask::A) == ColorMask::ZERO)
-						{
-							pixel_color.a = cur.a;
-						}
-						fbuf->write(row, col, pixel_color);
+						pixel_color.r = cur.r;
+					}
+					if ((color_mask & ColorMask::G) == ColorMask::ZERO)
+					{
+						pixel_color.g = cur.g;
+					}
+					if ((color_mask & ColorMask::B) == ColorMask::ZERO)
+					{
+						pixel_color.b = cur.b;
+					}
+					if ((color_mask & ColorMask::A) == ColorMask::ZERO)
+					{
+						pixel_color.a = cur.a;
 					}
 				}
+				cur = pixel_color;
 			}
 		}
 
-		// update stencilbuf
-		if (enable_stencil_test)
-		{
-			update_stencil_buffer(stencilbuf, row, col, op_pass, stencil_pass_op, stencil_fail_op, stencil_zfail_op, stencil_ref_val);
-		}
-
 		// stencil visualization
-		if ((misc_param.render_flag & RenderFlag::STENCIL) != RenderFlag::DISABLE)
+		if ((params.render_flag & RenderFlag::STENCIL) != RenderFlag::DISABLE)
 		{
 			uint8_t stencil;
-			if (stencilbuf->read(row, col, stencil))
+			if (this->zbuffer->read_stencil(row, col, stencil))
 			{
 				color_bgra c = Color::encode_bgra(stencil, stencil, stencil, 255);
 				fbuf->write(row, col, c);
@@ -713,19 +2100,19 @@ namespace Guarneri
 		}
 
 		// depth buffer visualization
-		if ((misc_param.render_flag & RenderFlag::DEPTH) != RenderFlag::DISABLE)
+		if ((params.render_flag & RenderFlag::DEPTH) != RenderFlag::DISABLE)
 		{
 			float cur_depth;
 			if (this->zbuffer->read(row, col, cur_depth))
 			{
-				float linear_depth = linearize_01depth(cur_depth, misc_param.cam_near, misc_param.cam_far);
+				float linear_depth = linearize_01depth(cur_depth, params.cam_near, params.cam_far);
 				Color depth_color = Color::WHITE * linear_depth;
 				color_bgra c = Color::encode_bgra(depth_color);
 				fbuf->write(row, col, c);
 			}
 		}
 
-		if ((misc_param.render_flag & RenderFlag::SHADOWMAP) != RenderFlag::DISABLE)
+		if ((params.render_flag & RenderFlag::SHADOWMAP) != RenderFlag::DISABLE)
 		{
 			float cur_depth;
 			if (this->shadowmap->read(row, col, cur_depth))
@@ -737,6 +2124,22 @@ namespace Guarneri
 		}
 	}
 
+	// perspective correct attributes of an interpolated vertex
+	v2f GraphicsDevice::fragment_input(const Vertex& v) const
+	{
+		v2f v_out;
+		float w = 1.0f / v.rhw;
+		v_out.position = v.position;
+		v_out.world_pos = v.world_pos * w;
+		v_out.shadow_coord = v.shadow_coord * w;
+		v_out.color = v.color * w;
+		v_out.normal = v.normal * w;
+		v_out.uv = v.uv * w;
+		v_out.tangent = v.tangent * w;
+		v_out.bitangent = v.bitangent * w;
+		return v_out;
+	}
+
 	bool GraphicsDevice::validate_fragment(const PerSampleOperation& op_pass) const
 	{
 		if ((op_pass & PerSampleOperation::SCISSOR_TEST) == PerSampleOperation::DISABLE) return false;
@@ -746,49 +2149,44 @@ namespace Guarneri
 		return true;
 	}
 
-	bool GraphicsDevice::perform_stencil_test(RawBuffer<uint8_t>* stencilbuf, const uint8_t& ref_val, const uint8_t& read_mask, const CompareFunc& func, const uint32_t& row, const uint32_t& col) const
+	bool GraphicsDevice::perform_stencil_test(const uint8_t& ref_val, const uint8_t& read_mask, const CompareFunc& func, const uint8_t& stencil) const
 	{
 		bool pass = false;
-		uint8_t stencil;
-		if (stencilbuf->read(row, col, stencil))
+		switch (func)
 		{
-			switch (func)
-			{
-			case CompareFunc::NEVER:
-				pass = false;
-				break;
-			case CompareFunc::ALWAYS:
-				pass = true;
-				break;
-			case CompareFunc::EQUAL:
-				pass = (ref_val & read_mask) == (stencil & read_mask);
-				break;
-			case CompareFunc::GREATER:
-				pass = (ref_val & read_mask) > (stencil & read_mask);
-				break;
-			case CompareFunc::LEQUAL:
-				pass = (ref_val & read_mask) <= (stencil & read_mask);
-				break;
-			case CompareFunc::NOT_EQUAL:
-				pass = (ref_val & read_mask) != (stencil & read_mask);
-				break;
-			case CompareFunc::GEQUAL:
-				pass = (ref_val & read_mask) > (stencil & read_mask);
-				break;
-			case CompareFunc::LESS:
-				pass = (ref_val & read_mask) < (stencil & read_mask);
-				break;
-			}
+		case CompareFunc::NEVER:
+			pass = false;
+			break;
+		case CompareFunc::ALWAYS:
+			pass = true;
+			break;
+		case CompareFunc::EQUAL:
+			pass = (ref_val & read_mask) == (stencil & read_mask);
+			break;
+		case CompareFunc::GREATER:
+			pass = (ref_val & read_mask) > (stencil & read_mask);
+			break;
+		case CompareFunc::LEQUAL:
+			pass = (ref_val & read_mask) <= (stencil & read_mask);
+			break;
+		case CompareFunc::NOT_EQUAL:
+			pass = (ref_val & read_mask) != (stencil & read_mask);
+			break;
+		case CompareFunc::GEQUAL:
+			pass = (ref_val & read_mask) > (stencil & read_mask);
+			break;
+		case CompareFunc::LESS:
+			pass = (ref_val & read_mask) < (stencil & read_mask);
+			break;
 		}
 		return pass;
 	}
 
-	void GraphicsDevice::update_stencil_buffer(RawBuffer<uint8_t>* stencilbuf, const uint32_t& row, const uint32_t& col, const PerSampleOperation& op_pass, const StencilOp& stencil_pass_op, const StencilOp& stencil_fail_op, const StencilOp& stencil_zfail_op, const uint8_t& ref_val) const
+	// the stencil value after the operation selected by the test results
+	uint8_t GraphicsDevice::update_stencil(const PerSampleOperation& op_pass, const StencilOp& stencil_pass_op, const StencilOp& stencil_fail_op, const StencilOp& stencil_zfail_op, const uint8_t& ref_val, const uint8_t& stencil) const
 	{
 		bool stencil_pass = (op_pass & PerSampleOperation::STENCIL_TEST) != PerSampleOperation::DISABLE;
 		bool z_pass = (op_pass & PerSampleOperation::DEPTH_TEST) != PerSampleOperation::DISABLE;
-		uint8_t stencil;
-		stencilbuf->read(row, col, stencil);
 		StencilOp stencil_op;
 		if (stencil_pass)
 		{
@@ -803,63 +2201,52 @@ namespace Guarneri
 		case StencilOp::KEEP:
 			break;
 		case StencilOp::ZERO:
-			stencilbuf->write(row, col, 0);
-			break;
+			return 0;
 		case StencilOp::REPLACE:
-			stencilbuf->write(row, col, ref_val);
-			break;
+			return ref_val;
 		case StencilOp::INCR:
-			stencilbuf->write(row, col, CLAMP((int)stencil + 1, 0, 255));
-			break;
+			return CLAMP((int)stencil + 1, 0, 255);
 		case StencilOp::DECR:
-			stencilbuf->write(row, col, CLAMP((int)stencil - 1, 0, 255));
-			break;
+			return CLAMP((int)stencil - 1, 0, 255);
 		case StencilOp::INCR_WRAP:
-			stencilbuf->write(row, col, stencil + 1);
-			break;
+			return stencil + 1;
 		case StencilOp::DECR_WRAP:
-			stencilbuf->write(row, col, stencil - 1);
-			break;
+			return stencil - 1;
 		case StencilOp::INVERT:
-			stencilbuf->write(row, col, ~stencil);
-			break;
+			return ~stencil;
 		}
+		return stencil;
 	}
 
-	bool GraphicsDevice::perform_depth_test(RawBuffer<float>* zbuf, const CompareFunc& func, const uint32_t& row, const uint32_t& col, const float& z) const
+	bool GraphicsDevice::perform_depth_test(const CompareFunc& func, const float& z, const float& depth) const
 	{
-		float depth;
-		bool pass = false;
-		if (zbuf->read(row, col, depth))
+		bool pass = z <= depth;
+		switch (func)
 		{
+		case CompareFunc::NEVER:
+			pass = false;
+			break;
+		case CompareFunc::ALWAYS:
+			pass = true;
+			break;
+		case CompareFunc::EQUAL:
+			pass = EQUALS(z, depth); // percision concern
+			break;
+		case CompareFunc::GREATER:
+			pass = z > depth;
+			break;
+		case CompareFunc::LEQUAL:
 			pass = z <= depth;
-			switch (func)
-			{
-			case CompareFunc::NEVER:
-				pass = false;
-				break;
-			case CompareFunc::ALWAYS:
-				pass = true;
-				break;
-			case CompareFunc::EQUAL:
-				pass = EQUALS(z, depth); // percision concern
-				break;
-			case CompareFunc::GREATER:
-				pass = z > depth;
-				break;
-			case CompareFunc::LEQUAL:
-				pass = z <= depth;
-				break;
-			case CompareFunc::NOT_EQUAL:
-				pass = z != depth;
-				break;
-			case CompareFunc::GEQUAL:
-				pass = z >= depth;
-				break;
-			case CompareFunc::LESS:
-				pass = z < depth;
-				break;
-			}
+			break;
+		case CompareFunc::NOT_EQUAL:
+			pass = z != depth;
+			break;
+		case CompareFunc::GEQUAL:
+			pass = z >= depth;
+			break;
+		case CompareFunc::LESS:
+			pass = z < depth;
+			break;
 		}
 		return pass;
 	}
@@ -1020,7 +2407,7 @@ namespace Guarneri
 		s1 = translation * s1;
 		s2 = translation * s2;
 
-		SegmentDrawer::bresenham(framebuffer.get(), (int)s1.x, (int)s1.y, (int)s2.x, (int)s2.y, Color::encode_bgra(col));
+		submit_segment({ (int)s1.x, (int)s1.y, (int)s2.x, (int)s2.y, Color::encode_bgra(col) });
 	}
 
 	void GraphicsDevice::draw_screen_segment(const Vector4& start, const Vector4& end, const Color& col)
@@ -1028,6 +2415,11 @@ namespace Guarneri
 		SegmentDrawer::bresenham(framebuffer.get(), (int)start.x, (int)start.y, (int)end.x, (int)end.y, Color::encode_bgra(col));
 	}
 
+	void GraphicsDevice::draw_screen_segment(const Vector4& start, const Vector4& end, const Color& col, const TileRegion& region)
+	{
+		SegmentDrawer::bresenham(framebuffer.get(), (int)start.x, (int)start.y, (int)end.x, (int)end.y, Color::encode_bgra(col), region.row_start, region.row_end, region.col_start, region.col_end);
+	}
+
 	void GraphicsDevice::draw_segment(const Vector3& start, const Vector3& end, const Color& col, const Matrix4x4& m, const Matrix4x4& v, const Matrix4x4& p)
 	{
 		Vector4 clip_start = p * v * m * Vector4(start);
@@ -1050,7 +2442,7 @@ namespace Guarneri
 		Vector4 s1 = ndc2viewport(n1);
 		Vector4 s2 = ndc2viewport(n2);
 
-		SegmentDrawer::bresenham(framebuffer.get(), (int)s1.x, (int)s1.y, (int)s2.x, (int)s2.y, Color::encode_bgra(col));
+		submit_segment({ (int)s1.x, (int)s1.y, (int)s2.x, (int)s2.y, Color::encode_bgra(col) });
 	}
 
 	void GraphicsDevice::draw_coordinates(const Vector3& pos, const Vector3& forward, const Vector3& up, const Vector3& right, const Matrix4x4& v, const Matrix4x4& p, const Vector2& offset)
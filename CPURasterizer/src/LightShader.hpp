@@ -9,6 +9,7 @@ namespace Guarneri
 	public:
 		LightShader();
 		~LightShader();
+		std::unique_ptr<Shader> clone() const;
 
 		v2f vertex_shader(const a2v& input) const;
 		Color fragment_shader(const v2f& input) const;
@@ -17,11 +18,18 @@ namespace Guarneri
 
 
 	LightShader::LightShader()
-	{}
+	{
+		this->varyings = Varying::NONE;
+	}
 
 	LightShader::~LightShader()
 	{}
 
+	std::unique_ptr<Shader> LightShader::clone() const
+	{
+		return std::make_unique<LightShader>(*this);
+	}
+
 	v2f LightShader::vertex_shader(const a2v& input) const
 	{
 		v2f o;
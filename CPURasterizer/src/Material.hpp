@@ -43,7 +43,7 @@ namespace Guarneri
 		static std::unique_ptr<Material> create(std::unique_ptr<Shader> shader);
 		static std::unique_ptr<Material> create(const Material& other);
 		Shader* get_shader(const RenderPass& pass) const;
-		void set_shadowmap(RawBuffer<float>* shadowmap);
+		void set_shadowmap(DepthStencilBuffer* shadowmap);
 		void sync(Shader* shader, const Matrix4x4& m, const Matrix4x4& v, const Matrix4x4& p);
 		void sync(const Matrix4x4& m, const Matrix4x4& v, const Matrix4x4& p);
 		void set_int(const property_name& name, const int& val);
@@ -161,7 +161,7 @@ namespace Guarneri
 		return target_shader.get();
 	}
 
-	void Material::set_shadowmap(RawBuffer<float>* shadowmap)
+	void Material::set_shadowmap(DepthStencilBuffer* shadowmap)
 	{
 		this->target_shader->shadowmap = shadowmap;
 	}
@@ -171,6 +171,7 @@ namespace Guarneri
 		shader->model = m;
 		shader->view = v;
 		shader->projection = p;
+		shader->normal_matrix = Matrix3x3(m).inverse().transpose();
 		shader->ztest_func = ztest_func;
 		shader->zwrite_mode = zwrite_mode;
 		shader->src_factor = src_factor;
@@ -4,33 +4,99 @@
 
 namespace Guarneri
 {
+	// vertex input as separate tightly packed streams, one element per vertex.
+	// positions are stored without w, which every vertex input has at 1.
+	// tangents and colors stay empty when no vertex sets them, fetch then supplies the defaults
 	class Mesh : public Object
 	{
 	public:
-		std::vector<Vertex> vertices;
+		std::vector<Vector3> positions;
+		std::vector<Vector3> normals;
+		std::vector<Vector2> uvs;
+		std::vector<Vector3> tangents;
+		std::vector<Vector4> colors;
 		std::vector<uint32_t> indices;
 
 	public:
 		Mesh(const std::vector<Vertex>& _vertices, const std::vector<uint32_t>& _indices);
 		~Mesh();
+		size_t vertex_count() const;
+		void fetch(const size_t& start, const size_t& end, a2v* inputs) const;
 		std::string str() const;
 	};
 
 
 	Mesh::Mesh(const std::vector<Vertex>& _vertices, const std::vector<uint32_t>& _indices)
 	{
-		this->vertices = _vertices;
+		const Vector4 default_color = Vector4();
+		bool has_tangents = false;
+		bool has_colors = false;
+		for (auto& vert : _vertices)
+		{
+			assert(vert.position.w == 1.0f);
+			has_tangents = has_tangents || vert.tangent.x != 0.0f || vert.tangent.y != 0.0f || vert.tangent.z != 0.0f;
+			has_colors = has_colors || vert.color.x != default_color.x || vert.color.y != default_color.y || vert.color.z != default_color.z || vert.color.w != default_color.w;
+		}
+		positions.reserve(_vertices.size());
+		normals.reserve(_vertices.size());
+		uvs.reserve(_vertices.size());
+		for (auto& vert : _vertices)
+		{
+			positions.emplace_back(vert.position.xyz());
+			normals.emplace_back(vert.normal);
+			uvs.emplace_back(vert.uv);
+			if (has_tangents)
+			{
+				tangents.emplace_back(vert.tangent);
+			}
+			if (has_colors)
+			{
+				colors.emplace_back(vert.color);
+			}
+		}
 		this->indices = _indices;
 	}
 
 	Mesh::~Mesh()
 	{}
 
+	size_t Mesh::vertex_count() const
+	{
+		return positions.size();
+	}
+
+	// inputs of the vertices [start, end), each stream is read sequentially on its own
+	void Mesh::fetch(const size_t& start, const size_t& end, a2v* inputs) const
+	{
+		assert(start <= end && end <= vertex_count());
+		size_t count = end - start;
+		for (size_t idx = 0; idx < count; idx++)
+		{
+			inputs[idx].position = Vector4(positions[start + idx], 1.0f);
+		}
+		for (size_t idx = 0; idx < count; idx++)
+		{
+			inputs[idx].normal = normals[start + idx];
+		}
+		for (size_t idx = 0; idx < count; idx++)
+		{
+			inputs[idx].uv = uvs[start + idx];
+		}
+		for (size_t idx = 0; idx < count; idx++)
+		{
+			inputs[idx].tangent = tangents.empty() ? Vector3() : tangents[start + idx];
+		}
+		for (size_t idx = 0; idx < count; idx++)
+		{
+			inputs[idx].color = colors.empty() ? Vector4() : colors[start + idx];
+		}
+	}
+
 	std::string Mesh::str() const
 	{
 		std::stringstream ss;
-		ss << "Mesh[" << this->id << " vertices: " << vertices.size() << " indices: " << indices.size() << "]";
+		ss << "Mesh[" << this->id << " vertices: " << vertex_count() << " indices: " << indices.size() << "]";
 		return ss.str();
 	}
 }
-#endif
\ No newline at end of file
+#endif
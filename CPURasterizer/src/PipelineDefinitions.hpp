@@ -5,12 +5,76 @@ namespace Guarneri{
 	#define LEFT_HANDED
 	#define FAR_Z 1.0f
 	#define DEFAULT_STENCIL 0x00
+	// fixed-point rasterization, 8 bits sub-pixel precision
+	#define SUBPIXEL_BITS 8
+	#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+	#define SUBPIXEL_HALF (SUBPIXEL_ONE >> 1)
+	// keeps edge function products inside int64
+	#define SUBPIXEL_MAX_COORD 524288.0f
+	// default size of the coarse rasterization blocks, in pixels
+	#define DEFAULT_RASTER_BLOCK_SIZE 8
+	// pixels handled by one span kernel call
+	#define RASTER_SPAN_WIDTH 8
+	// position, rhw and every varying
+	#define MAX_VARYING_FLOATS 27
+	// pixels covered by one hierarchical z entry
+	#define HIZ_BLOCK_SIZE 8
+	// side of the blocks of tiled and morton buffers, neither spans nor hiz blocks straddle two blocks
+	#define BUFFER_BLOCK_BITS 3
+	#define BUFFER_BLOCK_SIZE (1 << BUFFER_BLOCK_BITS)
+	// absorbs rounding between the z plane and the span kernels
+	#define HIZ_EPSILON 1e-6f
+	// near, left, right, bottom, top
+	#define CLIP_PLANE_COUNT 5
+	#define NEAR_CLIP_BIT 1u
+	// a triangle clipped by all planes gains one vertex per plane
+	#define MAX_CLIP_VERTICES (3 + CLIP_PLANE_COUNT)
+	// clip space x and y range accepted without clipping, in multiples of w
+	#define DEFAULT_GUARD_BAND 8.0f
+	// empty visibility buffer sample
+	#define INVALID_TRIANGLE_ID 0xFFFFFFFFu
+	// frame-wide triangle indices are binner index << BINNED_TRIANGLE_BITS | index in that binner
+	#define BINNED_TRIANGLE_BITS 24
+	#define BINNED_TRIANGLE_MASK ((1u << BINNED_TRIANGLE_BITS) - 1u)
+	#define MAX_TILE_BINNERS (1u << (32 - BINNED_TRIANGLE_BITS))
+	// low bits of a draw sequence number tell apart the fan triangles of one clipped triangle
+	#define SEQUENCE_FAN_BITS 3
+	static_assert(MAX_CLIP_VERTICES - 2 <= (1 << SEQUENCE_FAN_BITS), "fan triangles must fit in the sequence fan bits");
+	// vertices shaded per job by the vertex stage of an indexed draw
+	#define VERTEX_BATCH_SIZE 1024
+	// vertices gathered at a time from the mesh streams into vertex shader inputs
+	#define VERTEX_FETCH_SIZE 64
+	// tile edge length in pixels unless initialize is given another one
+	#define DEFAULT_TILE_SIZE 256
+	#define DEFAULT_TILE_TASK_SIZE 1
+	// estimated cost of setting up one triangle in a tile, in pixels
+	#define TILE_TRIANGLE_COST 64
+	// tiles above 1 / TILE_SPLIT_FACTOR of one thread's share of the frame are split
+	#define TILE_SPLIT_FACTOR 2
+	// clearing a pixel costs 1 / (1 << TILE_CLEAR_COST_SHIFT) of rasterizing it
+	#define TILE_CLEAR_COST_SHIFT 3
+	// frames rendered per candidate layout during tile calibration
+	#define TILE_CALIBRATION_FRAMES 4
+	// assumed when cpuid does not report the L2 size
+	#define DEFAULT_L2_CACHE_SIZE (256 * 1024)
 
 	enum class RasterizerStrategy {
 		SCANBLOCK,
 		SCANLINE
 	};
 
+	enum class SIMDLevel {
+		SCALAR,
+		SSE4,
+		AVX2
+	};
+
+	enum class BlockCoverage {
+		OUTSIDE,
+		PARTIAL,
+		INSIDE
+	};
+
 	enum class ColorSpace
 	{
 		Gamma,
@@ -101,12 +165,29 @@ namespace Guarneri{
 		A = 1 << 3
 	};
 
+	// v2f fields read by a fragment shader
+	enum class Varying {
+		NONE = 0,
+		WORLD_POS = 1 << 0,
+		UV = 1 << 1,
+		COLOR = 1 << 2,
+		NORMAL = 1 << 3,
+		TANGENT = 1 << 4,
+		BITANGENT = 1 << 5,
+		SHADOW_COORD = 1 << 6,
+		ALL = WORLD_POS | UV | COLOR | NORMAL | TANGENT | BITANGENT | SHADOW_COORD
+	};
+
 	enum class CullingAndClippingFlag {
 		DISABLE = 0,
 		APP_FRUSTUM_CULLING = 1 << 0,
+		// the near plane is always clipped, the flag is only kept for existing configurations
 		NEAR_PLANE_CLIPPING = 1 << 1,
-		SCREEN_CLIPPING = 1 << 2,
-		BACK_FACE_CULLING = 1 << 3
+		// without it x and y are only clipped where the fixed point range of the viewport ends
+		GUARD_BAND_CLIPPING = 1 << 2,
+		BACK_FACE_CULLING = 1 << 3,
+		HIZ_CULLING = 1 << 4,
+		TILE_OVERLAP_CULLING = 1 << 5
 	};
 
 	enum class PerSampleOperation {
@@ -152,7 +233,11 @@ namespace Guarneri{
 	enum class RenderPass {
 		OBJECT,
 		SHADOW,
-		SKYBOX
+		SKYBOX,
+		// depth only, fills zbuffer before the opaque objects are shaded
+		DEPTH_PREPASS,
+		// opaque objects after DEPTH_PREPASS, only the visible surface passes the depth test
+		SHADING
 	};
 
 	template<>
@@ -170,6 +255,9 @@ namespace Guarneri{
 	template<>
 	struct support_bitwise_enum<ColorMask> : std::true_type {};
 
+	template<>
+	struct support_bitwise_enum<Varying> : std::true_type {};
+
 
 	static std::ostream& operator << (std::ostream& stream, const RenderFlag& flag) {
 		int count = 0;
@@ -303,8 +391,16 @@ namespace Guarneri{
 			stream << (count > 0 ? " | NEAR_PLANE_CLIPPING" : "NEAR_PLANE_CLIPPING");
 			count++;
 		}
-		if ((flag & CullingAndClippingFlag::SCREEN_CLIPPING) != CullingAndClippingFlag::DISABLE) {
-			stream << (count > 0 ? " | SCREEN_CLIPPING" : "SCREEN_CLIPPING");
+		if ((flag & CullingAndClippingFlag::GUARD_BAND_CLIPPING) != CullingAndClippingFlag::DISABLE) {
+			stream << (count > 0 ? " | GUARD_BAND_CLIPPING" : "GUARD_BAND_CLIPPING");
+			count++;
+		}
+		if ((flag & CullingAndClippingFlag::HIZ_CULLING) != CullingAndClippingFlag::DISABLE) {
+			stream << (count > 0 ? " | HIZ_CULLING" : "HIZ_CULLING");
+			count++;
+		}
+		if ((flag & CullingAndClippingFlag::TILE_OVERLAP_CULLING) != CullingAndClippingFlag::DISABLE) {
+			stream << (count > 0 ? " | TILE_OVERLAP_CULLING" : "TILE_OVERLAP_CULLING");
 			count++;
 		}
 		return stream;
@@ -324,8 +420,16 @@ namespace Guarneri{
 			stream << (count > 0 ? " | NEAR_PLANE_CLIPPING" : "NEAR_PLANE_CLIPPING");
 			count++;
 		}
-		if ((flag & CullingAndClippingFlag::SCREEN_CLIPPING) != CullingAndClippingFlag::DISABLE) {
-			stream << (count > 0 ? " | SCREEN_CLIPPING" : "SCREEN_CLIPPING");
+		if ((flag & CullingAndClippingFlag::GUARD_BAND_CLIPPING) != CullingAndClippingFlag::DISABLE) {
+			stream << (count > 0 ? " | GUARD_BAND_CLIPPING" : "GUARD_BAND_CLIPPING");
+			count++;
+		}
+		if ((flag & CullingAndClippingFlag::HIZ_CULLING) != CullingAndClippingFlag::DISABLE) {
+			stream << (count > 0 ? " | HIZ_CULLING" : "HIZ_CULLING");
+			count++;
+		}
+		if ((flag & CullingAndClippingFlag::TILE_OVERLAP_CULLING) != CullingAndClippingFlag::DISABLE) {
+			stream << (count > 0 ? " | TILE_OVERLAP_CULLING" : "TILE_OVERLAP_CULLING");
 			count++;
 		}
 		return stream;
@@ -0,0 +1,389 @@
+#ifndef _RASTER_KERNEL_
+#define _RASTER_KERNEL_
+#include <CPURasterizer.hpp>
+
+#if defined(_MSC_VER)
+#define SIMD_TARGET_SSE4
+#define SIMD_TARGET_AVX2
+#else
+#define SIMD_TARGET_SSE4 __attribute__((target("sse4.2")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace Guarneri
+{
+	// up to RASTER_SPAN_WIDTH pixels on one row
+	struct RasterSpan
+	{
+	public:
+		int count;
+		// edge values of the first pixel and their per pixel increments
+		int64_t w[3];
+		int64_t step[3];
+		int64_t bias[3];
+		float inv_area;
+		// screen space depth of the ccw ordered vertices
+		float z[3];
+		// skips edge tests if the span is known to be inside the triangle
+		bool inside;
+		// see TriangleSetup::fits_simd
+		bool fits_simd;
+		// depth of the span, nullptr disables the depth test
+		const float* depth;
+		CompareFunc ztest_func;
+	};
+
+	struct RasterSpanResult
+	{
+	public:
+		// covered pixels
+		uint32_t coverage;
+		// covered pixels which passed the depth test
+		uint32_t mask;
+		float w0[RASTER_SPAN_WIDTH];
+		float w1[RASTER_SPAN_WIDTH];
+		float w2[RASTER_SPAN_WIDTH];
+		float z[RASTER_SPAN_WIDTH];
+	};
+
+	// coverage, depth interpolation and depth test of a span, scalar and SIMD implementations produce identical results
+	class RasterKernel
+	{
+	public:
+		static void evaluate(const RasterSpan& span, RasterSpanResult& result);
+		static SIMDLevel detect();
+		static SIMDLevel get_level();
+		static void set_level(const SIMDLevel& level);
+		static std::string str(const SIMDLevel& level);
+		static int count_bits(uint32_t mask);
+
+	private:
+		static SIMDLevel& current_level();
+		static bool depth_pass(const CompareFunc& func, const float& z, const float& depth);
+		static void evaluate_scalar(const RasterSpan& span, RasterSpanResult& result);
+		SIMD_TARGET_SSE4 static void evaluate_sse4(const RasterSpan& span, RasterSpanResult& result);
+		SIMD_TARGET_AVX2 static void evaluate_avx2(const RasterSpan& span, RasterSpanResult& result);
+	};
+
+
+	void RasterKernel::evaluate(const RasterSpan& span, RasterSpanResult& result)
+	{
+		if (!span.fits_simd)
+		{
+			evaluate_scalar(span, result);
+			return;
+		}
+		switch (current_level())
+		{
+		case SIMDLevel::AVX2:
+			evaluate_avx2(span, result);
+			break;
+		case SIMDLevel::SSE4:
+			evaluate_sse4(span, result);
+			break;
+		default:
+			evaluate_scalar(span, result);
+			break;
+		}
+	}
+
+	SIMDLevel RasterKernel::detect()
+	{
+		uint32_t ecx1 = 0, ebx7 = 0;
+		uint64_t xcr0 = 0;
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		int max_leaf = info[0];
+		__cpuid(info, 1);
+		ecx1 = (uint32_t)info[2];
+		if (max_leaf >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			ebx7 = (uint32_t)info[1];
+		}
+		if ((ecx1 & (1u << 27)) != 0)
+		{
+			xcr0 = _xgetbv(0);
+		}
+#else
+		uint32_t eax, ebx, ecx, edx;
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		{
+			ecx1 = ecx;
+		}
+		if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		{
+			ebx7 = ebx;
+		}
+		if ((ecx1 & (1u << 27)) != 0)
+		{
+			uint32_t lo, hi;
+			__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+			xcr0 = ((uint64_t)hi << 32) | lo;
+		}
+#endif
+		bool sse42 = (ecx1 & (1u << 20)) != 0;
+		// avx2 also needs the os to preserve ymm registers
+		bool avx = (ecx1 & (1u << 28)) != 0 && (xcr0 & 0x6) == 0x6;
+		bool avx2 = avx && (ebx7 & (1u << 5)) != 0;
+		if (avx2)
+		{
+			return SIMDLevel::AVX2;
+		}
+		if (sse42)
+		{
+			return SIMDLevel::SSE4;
+		}
+		return SIMDLevel::SCALAR;
+	}
+
+	SIMDLevel RasterKernel::get_level()
+	{
+		return current_level();
+	}
+
+	// levels above the detected one fall back to the detected one
+	void RasterKernel::set_level(const SIMDLevel& level)
+	{
+		SIMDLevel supported = detect();
+		current_level() = (int)level > (int)supported ? supported : level;
+	}
+
+	std::string RasterKernel::str(const SIMDLevel& level)
+	{
+		switch (level)
+		{
+		case SIMDLevel::AVX2:
+			return "AVX2";
+		case SIMDLevel::SSE4:
+			return "SSE4";
+		default:
+			return "SCALAR";
+		}
+	}
+
+	int RasterKernel::count_bits(uint32_t mask)
+	{
+		int count = 0;
+		while (mask != 0)
+		{
+			mask &= mask - 1;
+			count++;
+		}
+		return count;
+	}
+
+	SIMDLevel& RasterKernel::current_level()
+	{
+		static SIMDLevel level = detect();
+		return level;
+	}
+
+	// same comparison as GraphicsDevice::perform_depth_test, EQUAL is left to the per sample test
+	bool RasterKernel::depth_pass(const CompareFunc& func, const float& z, const float& depth)
+	{
+		switch (func)
+		{
+		case CompareFunc::NEVER:
+			return false;
+		case CompareFunc::ALWAYS:
+		case CompareFunc::EQUAL:
+			return true;
+		case CompareFunc::GREATER:
+			return z > depth;
+		case CompareFunc::LEQUAL:
+			return z <= depth;
+		case CompareFunc::NOT_EQUAL:
+			return z != depth;
+		case CompareFunc::GEQUAL:
+			return z >= depth;
+		case CompareFunc::LESS:
+			return z < depth;
+		}
+		return z <= depth;
+	}
+
+	void RasterKernel::evaluate_scalar(const RasterSpan& span, RasterSpanResult& result)
+	{
+		result.coverage = 0;
+		result.mask = 0;
+		for (int i = 0; i < span.count; i++)
+		{
+			int64_t w0 = span.w[0] + span.step[0] * i;
+			int64_t w1 = span.w[1] + span.step[1] * i;
+			int64_t w2 = span.w[2] + span.step[2] * i;
+			if (!span.inside && (w0 | w1 | w2) < 0)
+			{
+				continue;
+			}
+			float b0 = (float)(w0 + span.bias[0]) * span.inv_area;
+			float b1 = (float)(w1 + span.bias[1]) * span.inv_area;
+			float b2 = (float)(w2 + span.bias[2]) * span.inv_area;
+			float z = span.z[0] * b0 + span.z[1] * b1 + span.z[2] * b2;
+			result.w0[i] = b0;
+			result.w1[i] = b1;
+			result.w2[i] = b2;
+			result.z[i] = z;
+			result.coverage |= 1u << i;
+			if (span.depth == nullptr || depth_pass(span.ztest_func, z, span.depth[i]))
+			{
+				result.mask |= 1u << i;
+			}
+		}
+	}
+
+	// 4 pixels per iteration, edge values stay in int64 and are converted through doubles,
+	// which is exact as long as TriangleSetup::fits_simd holds
+	SIMD_TARGET_SSE4 void RasterKernel::evaluate_sse4(const RasterSpan& span, RasterSpanResult& result)
+	{
+		const __m128i magic_i = _mm_set1_epi64x(0x4338000000000000LL);
+		const __m128d magic_d = _mm_castsi128_pd(magic_i);
+		const __m128 inv_area = _mm_set1_ps(span.inv_area);
+		const __m128 z0 = _mm_set1_ps(span.z[0]);
+		const __m128 z1 = _mm_set1_ps(span.z[1]);
+		const __m128 z2 = _mm_set1_ps(span.z[2]);
+		const __m128i threshold = _mm_set1_epi64x(-1);
+
+		float depth[RASTER_SPAN_WIDTH];
+		std::fill(depth, depth + RASTER_SPAN_WIDTH, FAR_Z);
+		if (span.depth != nullptr)
+		{
+			std::copy(span.depth, span.depth + span.count, depth);
+		}
+
+		uint32_t coverage = 0;
+		uint32_t pass = 0;
+		for (int base = 0; base < span.count; base += 4)
+		{
+			uint32_t lanes = 0xF;
+			__m128 b[3];
+			for (int e = 0; e < 3; e++)
+			{
+				int64_t w = span.w[e] + span.step[e] * base;
+				__m128i lo = _mm_set_epi64x(w + span.step[e], w);
+				__m128i hi = _mm_add_epi64(lo, _mm_set1_epi64x(span.step[e] * 2));
+				uint32_t in_lo = (uint32_t)_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(lo, threshold)));
+				uint32_t in_hi = (uint32_t)_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(hi, threshold)));
+				lanes &= in_lo | (in_hi << 2);
+				__m128i bias = _mm_set1_epi64x(span.bias[e]);
+				__m128d d_lo = _mm_sub_pd(_mm_castsi128_pd(_mm_add_epi64(_mm_add_epi64(lo, bias), magic_i)), magic_d);
+				__m128d d_hi = _mm_sub_pd(_mm_castsi128_pd(_mm_add_epi64(_mm_add_epi64(hi, bias), magic_i)), magic_d);
+				b[e] = _mm_mul_ps(_mm_movelh_ps(_mm_cvtpd_ps(d_lo), _mm_cvtpd_ps(d_hi)), inv_area);
+			}
+			__m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(z0, b[0]), _mm_mul_ps(z1, b[1])), _mm_mul_ps(z2, b[2]));
+			_mm_storeu_ps(result.w0 + base, b[0]);
+			_mm_storeu_ps(result.w1 + base, b[1]);
+			_mm_storeu_ps(result.w2 + base, b[2]);
+			_mm_storeu_ps(result.z + base, z);
+			lanes = span.inside ? 0xF : lanes;
+			coverage |= lanes << base;
+
+			uint32_t depth_lanes = 0xF;
+			if (span.depth != nullptr)
+			{
+				__m128 d = _mm_loadu_ps(depth + base);
+				switch (span.ztest_func)
+				{
+				case CompareFunc::NEVER:
+					depth_lanes = 0;
+					break;
+				case CompareFunc::ALWAYS:
+				case CompareFunc::EQUAL:
+					break;
+				case CompareFunc::GREATER:
+					depth_lanes = (uint32_t)_mm_movemask_ps(_mm_cmpgt_ps(z, d));
+					break;
+				case CompareFunc::NOT_EQUAL:
+					depth_lanes = (uint32_t)_mm_movemask_ps(_mm_cmpneq_ps(z, d));
+					break;
+				case CompareFunc::GEQUAL:
+					depth_lanes = (uint32_t)_mm_movemask_ps(_mm_cmpge_ps(z, d));
+					break;
+				case CompareFunc::LESS:
+					depth_lanes = (uint32_t)_mm_movemask_ps(_mm_cmplt_ps(z, d));
+					break;
+				default:
+					depth_lanes = (uint32_t)_mm_movemask_ps(_mm_cmple_ps(z, d));
+					break;
+				}
+			}
+			pass |= (lanes & depth_lanes) << base;
+		}
+
+		uint32_t valid = (1u << span.count) - 1;
+		result.coverage = coverage & valid;
+		result.mask = pass & valid;
+	}
+
+	// 8 pixels per iteration, 4 int64 edge values per register
+	SIMD_TARGET_AVX2 void RasterKernel::evaluate_avx2(const RasterSpan& span, RasterSpanResult& result)
+	{
+		const __m256i magic_i = _mm256_set1_epi64x(0x4338000000000000LL);
+		const __m256d magic_d = _mm256_castsi256_pd(magic_i);
+		const __m256i threshold = _mm256_set1_epi64x(-1);
+		const __m256 inv_area = _mm256_set1_ps(span.inv_area);
+
+		uint32_t covered = 0xFF;
+		__m256 b[3];
+		for (int e = 0; e < 3; e++)
+		{
+			int64_t w = span.w[e];
+			int64_t s = span.step[e];
+			__m256i lo = _mm256_set_epi64x(w + s * 3, w + s * 2, w + s, w);
+			__m256i hi = _mm256_add_epi64(lo, _mm256_set1_epi64x(s * 4));
+			uint32_t in_lo = (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(lo, threshold)));
+			uint32_t in_hi = (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(hi, threshold)));
+			covered &= in_lo | (in_hi << 4);
+			__m256i bias = _mm256_set1_epi64x(span.bias[e]);
+			__m256d d_lo = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(_mm256_add_epi64(lo, bias), magic_i)), magic_d);
+			__m256d d_hi = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(_mm256_add_epi64(hi, bias), magic_i)), magic_d);
+			__m256 f = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(d_lo)), _mm256_cvtpd_ps(d_hi), 1);
+			b[e] = _mm256_mul_ps(f, inv_area);
+		}
+		__m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(span.z[0]), b[0]), _mm256_mul_ps(_mm256_set1_ps(span.z[1]), b[1])), _mm256_mul_ps(_mm256_set1_ps(span.z[2]), b[2]));
+		_mm256_storeu_ps(result.w0, b[0]);
+		_mm256_storeu_ps(result.w1, b[1]);
+		_mm256_storeu_ps(result.w2, b[2]);
+		_mm256_storeu_ps(result.z, z);
+
+		uint32_t valid = (1u << span.count) - 1;
+		covered = span.inside ? valid : (covered & valid);
+
+		uint32_t depth_lanes = 0xFF;
+		if (span.depth != nullptr)
+		{
+			float depth[RASTER_SPAN_WIDTH];
+			std::fill(depth, depth + RASTER_SPAN_WIDTH, FAR_Z);
+			std::copy(span.depth, span.depth + span.count, depth);
+			__m256 d = _mm256_loadu_ps(depth);
+			switch (span.ztest_func)
+			{
+			case CompareFunc::NEVER:
+				depth_lanes = 0;
+				break;
+			case CompareFunc::ALWAYS:
+			case CompareFunc::EQUAL:
+				break;
+			case CompareFunc::GREATER:
+				depth_lanes = (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(z, d, _CMP_GT_OQ));
+				break;
+			case CompareFunc::NOT_EQUAL:
+				depth_lanes = (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(z, d, _CMP_NEQ_UQ));
+				break;
+			case CompareFunc::GEQUAL:
+				depth_lanes = (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(z, d, _CMP_GE_OQ));
+				break;
+			case CompareFunc::LESS:
+				depth_lanes = (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(z, d, _CMP_LT_OQ));
+				break;
+			default:
+				depth_lanes = (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(z, d, _CMP_LE_OQ));
+				break;
+			}
+		}
+		result.coverage = covered;
+		result.mask = covered & depth_lanes;
+	}
+}
+#endif
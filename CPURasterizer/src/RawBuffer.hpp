@@ -4,55 +4,89 @@
 
 namespace Guarneri
 {
+	// order of the pixels in memory
+	enum class BufferLayout
+	{
+		// row * width + col
+		LINEAR,
+		// BUFFER_BLOCK_SIZE square blocks in row-major order, pixels row-major inside a block
+		TILED,
+		// the same blocks, pixels in z-order inside a block
+		MORTON
+	};
+
+
 	template<typename T>
 	class RawBuffer
 	{
 	private:
 		T* buffer;
 		void (*deletor)(T* ptr);
+		// blocks per row of a tiled or morton buffer, whose size is padded to whole blocks
+		uint32_t block_columns;
 
 	public:
 		uint32_t width;
 		uint32_t height;
+		BufferLayout layout;
 
 	public:
-		RawBuffer(uint32_t _width, uint32_t _height);
+		RawBuffer(uint32_t _width, uint32_t _height, BufferLayout _layout = BufferLayout::LINEAR);
 		RawBuffer(void* _buffer, uint32_t _width, uint32_t _height, void (*deletor)(T* ptr));
 		RawBuffer(const RawBuffer<T>& other);
 		~RawBuffer();
-		static std::shared_ptr<RawBuffer> create(uint32_t _width, uint32_t _height);
+		static std::shared_ptr<RawBuffer> create(uint32_t _width, uint32_t _height, BufferLayout _layout = BufferLayout::LINEAR);
 		static std::shared_ptr<RawBuffer> create(void* _buffer, uint32_t _width, uint32_t _height, void (*deletor)(T* ptr));
 		static std::shared_ptr<RawBuffer> create(const RawBuffer<T>& other);
 		bool read(const float& u, const float& v, T& out) const;
 		bool read(const uint32_t& row, const uint32_t& col, T& out) const;
 		bool write(const float& u, const float& v, const T& data);
 		bool write(const uint32_t& row, const uint32_t& col, const T& data);
+		T& at(const uint32_t& row, const uint32_t& col);
+		const T& at(const uint32_t& row, const uint32_t& col) const;
 		void uv2pixel(const float& u, const float& v, uint32_t& row, uint32_t& col) const;
 		void clear(const T& val);
+		void clear(const T& val, const uint32_t& row_start, const uint32_t& row_end);
+		void clear(const T& val, const uint32_t& row_start, const uint32_t& row_end, const uint32_t& col_start, const uint32_t& col_end, const bool& streaming);
 		T* get_ptr(int& size);
+		T* get_ptr(const uint32_t& row, const uint32_t& col);
+		const T* get_ptr(const uint32_t& row, const uint32_t& col) const;
+		uint32_t span_length(const uint32_t& row, const uint32_t& col) const;
+		void copy_pixels(RawBuffer<T>& target) const;
+		void copy_pixels(RawBuffer<T>& target, const uint32_t& row_start, const uint32_t& row_end) const;
 		RawBuffer<T>& operator = (const RawBuffer<T>& other);
 		void copy(const RawBuffer<T>& other);
+
+	private:
+		size_t index(const uint32_t& row, const uint32_t& col) const;
+		size_t capacity() const;
+		void copy_blocks(RawBuffer<T>& target, const uint32_t& row_start, const uint32_t& row_end) const;
+		static void fill(T* dst, const size_t& count, const T& val, const bool& streaming);
 	};
 
 
 	template<typename T>
-	RawBuffer<T>::RawBuffer(uint32_t _width, uint32_t _height)
+	RawBuffer<T>::RawBuffer(uint32_t _width, uint32_t _height, BufferLayout _layout)
 	{
 		this->width = _width;
 		this->height = _height;
+		this->layout = _layout;
+		this->block_columns = (_width + BUFFER_BLOCK_SIZE - 1) / BUFFER_BLOCK_SIZE;
 		this->deletor = [](T* ptr)
 		{
 			delete[] ptr;
 		};
-		int buf_size = static_cast<int>(static_cast<long>(width) * static_cast<long>(_height));
-		this->buffer = new T[buf_size];
+		this->buffer = new T[capacity()];
 	}
 
+	// wraps memory of someone else, always linear
 	template<typename T>
 	RawBuffer<T>::RawBuffer(void* _buffer, uint32_t _width, uint32_t _height, void (*deletor)(T* ptr))
 	{
 		this->width = _width;
 		this->height = _height;
+		this->layout = BufferLayout::LINEAR;
+		this->block_columns = (_width + BUFFER_BLOCK_SIZE - 1) / BUFFER_BLOCK_SIZE;
 		this->deletor = deletor;
 		this->buffer = (T*)_buffer;
 	}
@@ -70,9 +104,9 @@ namespace Guarneri
 	}
 
 	template<typename T>
-	std::shared_ptr<RawBuffer<T>> RawBuffer<T>::create(uint32_t _width, uint32_t _height)
+	std::shared_ptr<RawBuffer<T>> RawBuffer<T>::create(uint32_t _width, uint32_t _height, BufferLayout _layout)
 	{
-		return std::make_shared<RawBuffer>(_width, _height);
+		return std::make_shared<RawBuffer>(_width, _height, _layout);
 	}
 
 	template<typename T>
@@ -98,12 +132,11 @@ namespace Guarneri
 	template<typename T>
 	bool RawBuffer<T>::read(const uint32_t& row, const uint32_t& col, T& out) const
 	{
-		uint32_t pos = row * width + col;
-		if (row >= height || col >= width || pos >= width * height)
+		if (row >= height || col >= width)
 		{
 			return false;
 		}
-		out = buffer[pos];
+		out = buffer[index(row, col)];
 		return true;
 	}
 
@@ -118,15 +151,64 @@ namespace Guarneri
 	template<typename T>
 	bool RawBuffer<T>::write(const uint32_t& row, const uint32_t& col, const T& data)
 	{
-		uint32_t pos = row * width + col;
-		if (row >= height || col >= width || pos >= width * height)
+		if (row >= height || col >= width)
 		{
 			return false;
 		}
-		buffer[pos] = data;
+		buffer[index(row, col)] = data;
 		return true;
 	}
 
+	// unchecked access for loops that clamp once per triangle, block or footprint, bounds are only asserted in debug builds
+	template<typename T>
+	T& RawBuffer<T>::at(const uint32_t& row, const uint32_t& col)
+	{
+		assert(row < height && col < width);
+		return buffer[index(row, col)];
+	}
+
+	template<typename T>
+	const T& RawBuffer<T>::at(const uint32_t& row, const uint32_t& col) const
+	{
+		assert(row < height && col < width);
+		return buffer[index(row, col)];
+	}
+
+	template<typename T>
+	size_t RawBuffer<T>::index(const uint32_t& row, const uint32_t& col) const
+	{
+		if (layout == BufferLayout::LINEAR)
+		{
+			return (size_t)row * width + col;
+		}
+		const uint32_t mask = BUFFER_BLOCK_SIZE - 1;
+		size_t block = ((size_t)(row >> BUFFER_BLOCK_BITS) * block_columns + (col >> BUFFER_BLOCK_BITS)) << (2 * BUFFER_BLOCK_BITS);
+		uint32_t x = col & mask;
+		uint32_t y = row & mask;
+		if (layout == BufferLayout::TILED)
+		{
+			return block + (y << BUFFER_BLOCK_BITS) + x;
+		}
+		// interleaves the 3 bits of x and y, x in the even bits
+		x = (x | (x << 2)) & 0x13;
+		x = (x | (x << 1)) & 0x15;
+		y = (y | (y << 2)) & 0x13;
+		y = (y | (y << 1)) & 0x15;
+		return block + (x | (y << 1));
+	}
+
+	// elements allocated, blocked layouts are padded to whole blocks
+	template<typename T>
+	size_t RawBuffer<T>::capacity() const
+	{
+		if (layout == BufferLayout::LINEAR)
+		{
+			return (size_t)width * height;
+		}
+		size_t block_rows = (height + BUFFER_BLOCK_SIZE - 1) / BUFFER_BLOCK_SIZE;
+		return block_rows * block_columns * BUFFER_BLOCK_SIZE * BUFFER_BLOCK_SIZE;
+	}
+
 	template<typename T>
 	void RawBuffer<T>::uv2pixel(const float& u, const float& v, uint32_t& row, uint32_t& col) const
 	{
@@ -138,17 +220,207 @@ namespace Guarneri
 	template<typename T>
 	void RawBuffer<T>::clear(const T& val)
 	{
-		uint32_t size = width * height;
-		std::fill(buffer, buffer + size, val);
+		std::fill(buffer, buffer + capacity(), val);
+	}
+
+	// rows [row_start, row_end) only, the first write to a fresh page places it on the writing thread's numa node
+	template<typename T>
+	void RawBuffer<T>::clear(const T& val, const uint32_t& row_start, const uint32_t& row_end)
+	{
+		uint32_t end = std::min(row_end, height);
+		if (row_start >= end)
+		{
+			return;
+		}
+		if (layout == BufferLayout::LINEAR)
+		{
+			std::fill(buffer + (size_t)row_start * width, buffer + (size_t)end * width, val);
+			return;
+		}
+		// a whole block row, padding included, is consecutive in memory
+		const uint32_t mask = BUFFER_BLOCK_SIZE - 1;
+		const size_t block_row_size = (size_t)block_columns * BUFFER_BLOCK_SIZE * BUFFER_BLOCK_SIZE;
+		uint32_t row = row_start;
+		while (row < end)
+		{
+			uint32_t block_end = (row & ~mask) + BUFFER_BLOCK_SIZE;
+			if ((row & mask) == 0 && (block_end <= end || end == height))
+			{
+				T* start = buffer + (size_t)(row >> BUFFER_BLOCK_BITS) * block_row_size;
+				std::fill(start, start + block_row_size, val);
+				row = block_end;
+				continue;
+			}
+			for (uint32_t col = 0; col < width; col++)
+			{
+				buffer[index(row, col)] = val;
+			}
+			row++;
+		}
+	}
+
+	// a rectangle, streaming stores bypass the caches for pixels that are not read again soon
+	template<typename T>
+	void RawBuffer<T>::clear(const T& val, const uint32_t& row_start, const uint32_t& row_end, const uint32_t& col_start, const uint32_t& col_end, const bool& streaming)
+	{
+		uint32_t rend = std::min(row_end, height);
+		uint32_t cend = std::min(col_end, width);
+		for (uint32_t row = row_start; row < rend; row++)
+		{
+			for (uint32_t col = col_start; col < cend;)
+			{
+				uint32_t count = std::min(span_length(row, col), cend - col);
+				fill(buffer + index(row, col), count, val, streaming);
+				col += count;
+			}
+		}
+		if (streaming)
+		{
+			_mm_sfence();
+		}
+	}
+
+	// 16 byte non-temporal stores where T tiles a 16 byte vector, plain stores for the unaligned ends
+	template<typename T>
+	void RawBuffer<T>::fill(T* dst, const size_t& count, const T& val, const bool& streaming)
+	{
+		if (!streaming || 16 % sizeof(T) != 0 || count * sizeof(T) < 32)
+		{
+			std::fill(dst, dst + count, val);
+			return;
+		}
+		T* end = dst + count;
+		while (((uintptr_t)dst & 15) != 0 && dst < end)
+		{
+			*dst++ = val;
+		}
+		constexpr size_t lanes = sizeof(T) <= 16 ? 16 / sizeof(T) : 1;
+		T pattern[lanes];
+		std::fill(pattern, pattern + lanes, val);
+		__m128i vec = _mm_loadu_si128((const __m128i*)pattern);
+		for (; dst + lanes <= end; dst += lanes)
+		{
+			_mm_stream_si128((__m128i*)dst, vec);
+		}
+		std::fill(dst, end, val);
 	}
 
+	// the whole allocation, pixels are only in row * width + col order for linear buffers
 	template<typename T>
 	T* RawBuffer<T>::get_ptr(int& size)
 	{
-		size = width * height * sizeof(T);
+		size = (int)(capacity() * sizeof(T));
 		return buffer;
 	}
 
+	// address of one pixel, span_length pixels from there on are consecutive in memory
+	template<typename T>
+	T* RawBuffer<T>::get_ptr(const uint32_t& row, const uint32_t& col)
+	{
+		return buffer + index(row, col);
+	}
+
+	template<typename T>
+	const T* RawBuffer<T>::get_ptr(const uint32_t& row, const uint32_t& col) const
+	{
+		return buffer + index(row, col);
+	}
+
+	// pixels of the row starting at col that follow each other in memory
+	template<typename T>
+	uint32_t RawBuffer<T>::span_length(const uint32_t& row, const uint32_t& col) const
+	{
+		unused(row);
+		switch (layout)
+		{
+		case BufferLayout::LINEAR:
+			return width - col;
+		case BufferLayout::TILED:
+			return std::min(width, (col | (BUFFER_BLOCK_SIZE - 1)) + 1) - col;
+		default:
+			return (col & 1) == 0 && col + 1 < width ? 2 : 1;
+		}
+	}
+
+	// same sized target in any layout. linear targets are written a row at a time and read a block row at a time,
+	// this is what turns a blocked color target into the bitmap on present
+	template<typename T>
+	void RawBuffer<T>::copy_pixels(RawBuffer<T>& target) const
+	{
+		copy_pixels(target, 0, height);
+	}
+
+	template<typename T>
+	void RawBuffer<T>::copy_pixels(RawBuffer<T>& target, const uint32_t& row_start, const uint32_t& row_end) const
+	{
+		assert(target.width == width && target.height == height);
+		uint32_t end = std::min(row_end, height);
+		if (layout == BufferLayout::LINEAR && target.layout == BufferLayout::LINEAR)
+		{
+			std::copy(buffer + (size_t)row_start * width, buffer + (size_t)end * width, target.buffer + (size_t)row_start * width);
+			return;
+		}
+		if (layout != BufferLayout::LINEAR && target.layout == BufferLayout::LINEAR)
+		{
+			copy_blocks(target, row_start, end);
+			return;
+		}
+		// runs consecutive in both buffers are copied at once
+		for (uint32_t row = row_start; row < end; row++)
+		{
+			for (uint32_t col = 0; col < width;)
+			{
+				uint32_t count = std::min(span_length(row, col), target.span_length(row, col));
+				const T* src = buffer + index(row, col);
+				std::copy(src, src + count, target.buffer + target.index(row, col));
+				col += count;
+			}
+		}
+	}
+
+	// blocked to linear a block at a time, tiled block rows are copied as they are, morton blocks are de-swizzled
+	// through the in-block offsets of every pixel, which are those of the first block
+	template<typename T>
+	void RawBuffer<T>::copy_blocks(RawBuffer<T>& target, const uint32_t& row_start, const uint32_t& row_end) const
+	{
+		const uint32_t mask = BUFFER_BLOCK_SIZE - 1;
+		const size_t block_pixels = BUFFER_BLOCK_SIZE * BUFFER_BLOCK_SIZE;
+		uint8_t offsets[BUFFER_BLOCK_SIZE * BUFFER_BLOCK_SIZE];
+		for (uint32_t y = 0; y < BUFFER_BLOCK_SIZE; y++)
+		{
+			for (uint32_t x = 0; x < BUFFER_BLOCK_SIZE; x++)
+			{
+				offsets[(y << BUFFER_BLOCK_BITS) + x] = (uint8_t)index(y, x);
+			}
+		}
+		for (uint32_t row = row_start; row < row_end;)
+		{
+			uint32_t y_start = row & mask;
+			uint32_t y_end = std::min(row_end - (row & ~mask), (uint32_t)BUFFER_BLOCK_SIZE);
+			const T* block = buffer + (size_t)(row >> BUFFER_BLOCK_BITS) * block_columns * block_pixels;
+			for (uint32_t col = 0; col < width; col += BUFFER_BLOCK_SIZE, block += block_pixels)
+			{
+				uint32_t count = std::min(width - col, (uint32_t)BUFFER_BLOCK_SIZE);
+				T* dst = target.buffer + (size_t)(row - y_start) * width + col;
+				for (uint32_t y = y_start; y < y_end; y++)
+				{
+					T* dst_row = dst + (size_t)y * width;
+					const uint8_t* row_offsets = offsets + (y << BUFFER_BLOCK_BITS);
+					if (layout == BufferLayout::TILED)
+					{
+						std::copy(block + row_offsets[0], block + row_offsets[0] + count, dst_row);
+						continue;
+					}
+					for (uint32_t x = 0; x < count; x++)
+					{
+						dst_row[x] = block[row_offsets[x]];
+					}
+				}
+			}
+			row += y_end - y_start;
+		}
+	}
+
 	template<typename T>
 	RawBuffer<T>& RawBuffer<T>::operator = (const RawBuffer<T>& other)
 	{
@@ -162,6 +434,8 @@ namespace Guarneri
 		this->buffer = other.buffer;
 		this->width = other.width;
 		this->height = other.height;
+		this->layout = other.layout;
+		this->block_columns = other.block_columns;
 	}
 }
 #endif
\ No newline at end of file
@@ -19,9 +19,11 @@ namespace Guarneri
 		virtual Matrix4x4 view_matrix(const RenderPass& render_pass) const;
 		virtual Matrix4x4 projection_matrix(const RenderPass& render_pass) const;
 		virtual Matrix4x4 model_matrix() const;
-		static void draw_triangle(Shader* shader, const std::vector<Triangle>& triangles, const Matrix4x4& m, const Matrix4x4& v, const Matrix4x4& p);
 		virtual void render_shadow() const;
 		virtual void render() const;
+		virtual void render_depth() const;
+		virtual void render_shading() const;
+		bool support_depth_prepass() const;
 		void render_internal(const RenderPass& render_pass) const;
 		virtual void draw_gizmos() const;
 		Renderer& operator =(const Renderer& other);
@@ -79,22 +81,44 @@ namespace Guarneri
 		return target->transform.local2world;
 	}
 
-	void Renderer::draw_triangle(Shader* shader, const std::vector<Triangle>& triangles, const Matrix4x4& m, const Matrix4x4& v, const Matrix4x4& p)
+	void Renderer::render_shadow() const
 	{
-		for (auto& tri : triangles)
+		render_internal(RenderPass::SHADOW);
+	}
+
+	void Renderer::render() const
+	{
+		render_internal(RenderPass::OBJECT);
+	}
+
+	void Renderer::render_depth() const
+	{
+		if (!support_depth_prepass())
 		{
-			Graphics().draw(shader, tri[0], tri[1], tri[2], m, v, p);
+			return;
 		}
+		render_internal(RenderPass::DEPTH_PREPASS);
 	}
 
-	void Renderer::render_shadow() const
+	void Renderer::render_shading() const
 	{
-		render_internal(RenderPass::SHADOW);
+		if (!support_depth_prepass())
+		{
+			render_internal(RenderPass::OBJECT);
+			return;
+		}
+		render_internal(RenderPass::SHADING);
 	}
 
-	void Renderer::render() const
+	// the prepass has to leave exactly the depth the object would write itself
+	bool Renderer::support_depth_prepass() const
 	{
-		render_internal(RenderPass::OBJECT);
+		auto& material = target->material;
+		if (material->transparent || material->zwrite_mode != ZWrite::ON)
+		{
+			return false;
+		}
+		return material->ztest_func == CompareFunc::LESS || material->ztest_func == CompareFunc::LEQUAL;
 	}
 
 	void Renderer::render_internal(const RenderPass& render_pass) const
@@ -104,54 +128,46 @@ namespace Guarneri
 			return;
 		}
 
-		auto thread_size = std::thread::hardware_concurrency();
-		ThreadPool tp(thread_size);
-		
-		Vertex vertices[3];
 		target->material->set_shadowmap(Graphics().get_shadowmap());
 		target->material->sync(model_matrix(), view_matrix(render_pass), projection_matrix(render_pass));
+		if (render_pass == RenderPass::DEPTH_PREPASS)
+		{
+			// masked color makes the device skip fragment shading
+			Shader* shader = target->material->get_shader(render_pass);
+			shader->color_mask = ColorMask::ZERO;
+		}
+		else if (render_pass == RenderPass::SHADING)
+		{
+			// same vertices produce the same depth as the prepass
+			Shader* shader = target->material->get_shader(render_pass);
+			shader->ztest_func = CompareFunc::EQUAL;
+			shader->zwrite_mode = ZWrite::OFF;
+		}
 		if (target != nullptr)
 		{
+			// pipelined frames bin a copy, the material may change again before the frame is rendered
+			Shader* shader = Graphics().frame_shader(target->material->get_shader(render_pass));
 			for (auto& m : target->meshes)
 			{
 				assert(m->indices.size() % 3 == 0);
-				uint32_t idx = 0;
-				if (Graphics().multi_thread)
+				size_t triangle_count = m->indices.size() / 3;
+				uint64_t sequence = Graphics().reserve_sequence(triangle_count);
+				// each vertex is transformed once, triangles then only index the transformed vertices
+				Graphics().shade_vertices(shader, *m);
+				if (Graphics().parallel_submission())
 				{
-					std::vector<Triangle> tris;
-					auto block_size = m->indices.size() / thread_size;
-					tris.reserve(block_size);
-					for (auto& index : m->indices)
+					// jobs only carry an index range of the mesh, the call returns once all of them ran
+					JobSystem& jobs = Graphics().get_job_system();
+					size_t block_size = std::max((size_t)1, triangle_count / (jobs.worker_count() + 1));
+					const Mesh* mesh = m.get();
+					jobs.parallel_for(triangle_count, block_size, [&](size_t start, size_t end)
 					{
-						assert(idx < 3 && index < m->vertices.size());
-						vertices[idx] = m->vertices[index];
-						idx++;
-						if (idx == 3)
-						{
-							tris.emplace_back(Triangle(vertices[0], vertices[1], vertices[2]));
-							if (tris.size() == block_size)
-							{
-								tp.enqueue(draw_triangle, target->material->get_shader(render_pass), tris, model_matrix(), view_matrix(render_pass), projection_matrix(render_pass));
-								tris.clear();
-							}
-							idx = 0;
-						}
-					}
-					tp.enqueue(draw_triangle, target->material->get_shader(render_pass), tris, model_matrix(), view_matrix(render_pass), projection_matrix(render_pass));
+						Graphics().draw_indexed(shader, mesh->indices, start, end, sequence);
+					});
 				}
 				else
 				{
-					for (auto& index : m->indices)
-					{
-						assert(idx < 3 && index < m->vertices.size());
-						vertices[idx] = m->vertices[index];
-						idx++;
-						if (idx == 3)
-						{
-							Graphics().draw(target->material->get_shader(render_pass), vertices[0], vertices[1], vertices[2], model_matrix(), view_matrix(render_pass), projection_matrix(render_pass));
-							idx = 0;
-						}
-					}
+					Graphics().draw_indexed(shader, m->indices, 0, triangle_count, sequence);
 				}
 			}
 		}
@@ -132,6 +132,10 @@ namespace Guarneri
 				{
 					misc_param.render_flag = misc_param.render_flag ^ RenderFlag::STENCIL;
 				}
+				else if (code == KeyCode::F10)
+				{
+					misc_param.render_flag = misc_param.render_flag ^ RenderFlag::MIPMAP;
+				}
 				else if (code == KeyCode::Z)
 				{
 					misc_param.render_flag = misc_param.render_flag ^ RenderFlag::EARLY_Z_DEBUG;
@@ -152,6 +156,14 @@ namespace Guarneri
 				{
 					misc_param.shadow_bias /= 2.0f;
 				}
+				else if (code == KeyCode::X)
+				{
+					misc_param.depth_prepass = !misc_param.depth_prepass;
+				}
+				else if (code == KeyCode::V)
+				{
+					Graphics().visibility_buffer = !Graphics().visibility_buffer;
+				}
 		}, nullptr);
 	}
 
@@ -284,9 +296,27 @@ namespace Guarneri
 			// todo: CPU Frustum Culling
 		}
 
+		// sampled once so both passes agree within a frame
+		bool depth_prepass = misc_param.depth_prepass;
+		if (depth_prepass)
+		{
+			for (auto& obj : objects)
+			{
+				obj->render_depth();
+			}
+			Graphics().present();
+		}
+
 		for (auto& obj : objects)
 		{
-			obj->render();
+			if (depth_prepass)
+			{
+				obj->render_shading();
+			}
+			else
+			{
+				obj->render();
+			}
 		}
 
 		if (enable_skybox)
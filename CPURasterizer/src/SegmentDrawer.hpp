@@ -11,6 +11,8 @@ namespace Guarneri
 		static void dda(RawBuffer<T>* buffer, const int& x0, const int& y0, const int& x1, const int& y1, const T& c);
 		template<typename T>
 		static void bresenham(RawBuffer<T>* buffer, const int& x0, const int& y0, const int& x1, const int& y1, const T& c);
+		template<typename T>
+		static void bresenham(RawBuffer<T>* buffer, const int& x0, const int& y0, const int& x1, const int& y1, const T& c, const uint32_t& row_start, const uint32_t& row_end, const uint32_t& col_start, const uint32_t& col_end);
 	};
 
 
@@ -65,5 +67,41 @@ namespace Guarneri
 			}
 		}
 	}
+
+	// same line, only the pixels inside [row_start, row_end) x [col_start, col_end) are written
+	template<typename T>
+	void SegmentDrawer::bresenham(RawBuffer<T>* buffer, const int& x0, const int& y0, const int& x1, const int& y1, const T& c, const uint32_t& row_start, const uint32_t& row_end, const uint32_t& col_start, const uint32_t& col_end)
+	{
+		assert(buffer != nullptr);
+		int dx = std::abs(x1 - x0);
+		int dy = std::abs(y1 - y0);
+		int sx = x0 < x1 ? 1 : -1;
+		int sy = y0 < y1 ? 1 : -1;
+		int bias = dx > dy ? dx : -dy;
+		int dx2 = 2 * dx;
+		int dy2 = 2 * dy;
+		int xi = x0;
+		int yi = y0;
+		while (true)
+		{
+			if ((uint32_t)yi >= row_start && (uint32_t)yi < row_end && (uint32_t)xi >= col_start && (uint32_t)xi < col_end)
+			{
+				buffer->write((uint32_t)yi, (uint32_t)xi, c);
+			}
+			if (xi == x1 && yi == y1)
+			{
+				break;
+			}
+			int e = bias;
+			if (e > -dx2)
+			{
+				bias -= dy2; xi += sx;
+			}
+			if (e < dy2)
+			{
+				bias += dx2; yi += sy;
+			}
+		}
+	}
 }
 #endif
\ No newline at end of file
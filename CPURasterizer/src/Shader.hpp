@@ -13,7 +13,7 @@ namespace Guarneri
 		Vector3 tangent;
 	};
 
-	struct v2f
+	struct v2f_attributes
 	{
 		Vector4 position;
 		Vector3 world_pos;
@@ -25,6 +25,13 @@ namespace Guarneri
 		Vector4 shadow_coord;
 	};
 
+	struct v2f : public v2f_attributes
+	{
+		// screen space derivatives across the 2x2 quad, zero outside the tile based path
+		v2f_attributes ddx;
+		v2f_attributes ddy;
+	};
+
 	struct LightingData
 	{
 		LightingData()
@@ -44,13 +51,15 @@ namespace Guarneri
 	{
 	public:
 		Matrix4x4 model, view, projection;
+		// inverse transpose of the model matrix, computed once per draw instead of per vertex
+		Matrix3x3 normal_matrix;
 		std::unordered_map<property_name, float> name2float;
 		std::unordered_map<property_name, Vector4> name2float4;
 		std::unordered_map<property_name, int> name2int;
 		std::unordered_map<property_name, std::shared_ptr<Texture>> name2tex;
 		std::unordered_map<property_name, std::shared_ptr<CubeMap>> name2cubemap;
 		std::unordered_map<property_name, std::string> keywords;
-		RawBuffer<float>* shadowmap;
+		DepthStencilBuffer* shadowmap;
 		ColorMask color_mask;
 		CompareFunc stencil_func;
 		StencilOp stencil_pass_op;
@@ -71,10 +80,15 @@ namespace Guarneri
 		LightingData lighting_param;
 		bool discarded = false;
 		bool normal_map = false;
+		// only these v2f fields are interpolated for the fragment shader
+		Varying varyings;
+		// what fragment shading reads instead of misc_param, a frame snapshot for shaders copied by a pipelined frame
+		const MiscParameter* params;
 
 	public:
 		Shader();
 		virtual ~Shader();
+		virtual std::unique_ptr<Shader> clone() const;
 		virtual v2f vertex_shader(const a2v& input) const;
 		float get_shadow_atten(const Vector4& light_space_pos) const;
 		Vector3 reflect(const Vector3& n, const Vector3& light_out_dir) const;
@@ -106,11 +120,20 @@ namespace Guarneri
 		this->skybox = false;
 		this->shadow = false;
 		this->shadowmap = nullptr;
+		this->varyings = Varying::ALL;
+		this->params = &misc_param;
+		this->normal_matrix = Matrix3x3::IDENTITY;
 	}
 
 	Shader::~Shader()
 	{}
 
+	// derived shaders return their own type, frames keep these copies while they are rasterized
+	std::unique_ptr<Shader> Shader::clone() const
+	{
+		return std::make_unique<Shader>(*this);
+	}
+
 	v2f Shader::vertex_shader(const a2v& input) const
 	{
 		v2f o;
@@ -122,7 +145,6 @@ namespace Guarneri
 		o.world_pos = wpos.xyz();
 		o.shadow_coord = light_space_pos;
 		o.color = input.color;
-		Matrix3x3 normal_matrix = Matrix3x3(model).inverse().transpose();
 		if (normal_map)
 		{
 			Vector3 t = (normal_matrix * input.tangent).normalized();
@@ -160,7 +182,7 @@ namespace Guarneri
 
 		Vector2 texel_size = 1.0f / Vector2(shadowmap->height, shadowmap->width);
 
-		if (misc_param.pcf_on)
+		if (params->pcf_on)
 		{
 			const int kernel_size = 3;
 			// PCF
@@ -172,7 +194,7 @@ namespace Guarneri
 					if (shadowmap->read(proj_shadow_coord.x + (float)x * texel_size.x, proj_shadow_coord.y + (float)y * texel_size.y, depth))
 					{
 						//printf("shadowmap: %f depth: %f\n", depth, proj_shadow_coord.z);
-						shadow_atten += (proj_shadow_coord.z - misc_param.shadow_bias) > depth ? 1.0f : 0.0f;
+						shadow_atten += (proj_shadow_coord.z - params->shadow_bias) > depth ? 1.0f : 0.0f;
 					}
 				}
 			}
@@ -185,7 +207,7 @@ namespace Guarneri
 			if (shadowmap->read(proj_shadow_coord.x, proj_shadow_coord.y, depth))
 			{
 				//printf("shadowmap: %f depth: %f\n", depth, proj_shadow_coord.z);
-				shadow_atten = (proj_shadow_coord.z - misc_param.shadow_bias) > depth ? 1.0f : 0.0f;
+				shadow_atten = (proj_shadow_coord.z - params->shadow_bias) > depth ? 1.0f : 0.0f;
 			}
 		}
 
@@ -243,7 +265,7 @@ namespace Guarneri
 		return F0 + (std::max(Vector3(1.0f - roughness), F0) - F0) * std::pow(1.0f - cosTheta, 5.0f);
 	}
 
-	Vector3 metallic_workflow(const Vector3& albedo, const float& metallic, const float& roughness, const float& light_distance, const Vector3& halfway, const Vector3& light_dir, const Vector3& view_dir, const Vector3& normal)
+	Vector3 metallic_workflow(const Vector3& albedo, const float& metallic, const float& roughness, const float& light_distance, const Vector3& halfway, const Vector3& light_dir, const Vector3& view_dir, const Vector3& normal, const RenderFlag& render_flag)
 	{
 		Vector3 f0 = 0.04f;
 		f0 = Vector3::lerp(f0, albedo, metallic);
@@ -264,7 +286,7 @@ namespace Guarneri
 
 		float ndl = std::max(Vector3::dot(normal, light_dir), 0.0f);
 
-		if ((misc_param.render_flag & RenderFlag::SPECULAR) != RenderFlag::DISABLE)
+		if ((render_flag & RenderFlag::SPECULAR) != RenderFlag::DISABLE)
 		{
 			return specular;
 		}
@@ -292,7 +314,7 @@ namespace Guarneri
 
 		auto half_dir = (light_dir + view_dir).normalized();
 
-		if (misc_param.workflow == PBRWorkFlow::Specular)
+		if (params->workflow == PBRWorkFlow::Specular)
 		{
 			//todo
 			Color roughness = Color::WHITE;
@@ -318,7 +340,7 @@ namespace Guarneri
 			/*metallic = 0.0f;
 			roughness = 0.16f;*/
 
-			auto lo = metallic_workflow(Vector3(albedo.r, albedo.g, albedo.b), metallic.r, roughness.r, 0.4f, half_dir, light_dir, view_dir, normal);
+			auto lo = metallic_workflow(Vector3(albedo.r, albedo.g, albedo.b), metallic.r, roughness.r, 0.4f, half_dir, light_dir, view_dir, normal, params->render_flag);
 
 			//simple IBL
 			//todo: cubemap lod
@@ -368,7 +390,7 @@ namespace Guarneri
 
 		auto half_dir = (light_dir + view_dir).normalized();
 
-		if (misc_param.workflow == PBRWorkFlow::Specular)
+		if (params->workflow == PBRWorkFlow::Specular)
 		{
 			//todo
 			Color roughness = Color::WHITE;
@@ -393,7 +415,7 @@ namespace Guarneri
 			name2tex.count(metallic_prop) > 0 && name2tex.at(metallic_prop)->sample(uv.x, uv.y, metallic);
 			Color roughness = 0.0f;
 			name2tex.count(roughness_prop) > 0 && name2tex.at(roughness_prop)->sample(uv.x, uv.y, roughness);
-			auto lo = metallic_workflow(Vector3(albedo.r, albedo.g, albedo.b), metallic.r, roughness.r, dist, half_dir, light_dir, view_dir, normal);
+			auto lo = metallic_workflow(Vector3(albedo.r, albedo.g, albedo.b), metallic.r, roughness.r, dist, half_dir, light_dir, view_dir, normal, params->render_flag);
 			auto ret = ambient + Color(lo);
 			return ret;
 		}
@@ -401,10 +423,10 @@ namespace Guarneri
 
 	Color Shader::fragment_shader(const v2f& input) const
 	{
-		auto main_light = misc_param.main_light;
-		auto point_lights = misc_param.point_lights;
+		auto main_light = params->main_light;
+		auto point_lights = params->point_lights;
 
-		Vector3 cam_pos = misc_param.camera_pos;
+		Vector3 cam_pos = params->camera_pos;
 		Vector3 wpos = input.world_pos;
 		Vector4 screen_pos = input.position;
 
@@ -413,7 +435,7 @@ namespace Guarneri
 
 		Color normal_tex;
 		Matrix3x3 tbn;
-		if (name2tex.count(normal_prop) > 0 && name2tex.at(normal_prop)->sample(input.uv.x, input.uv.y, normal_tex))
+		if (name2tex.count(normal_prop) > 0 && name2tex.at(normal_prop)->sample(input.uv.x, input.uv.y, input.ddx.uv, input.ddy.uv, normal_tex))
 		{
 			tbn = Matrix3x3(input.tangent, input.bitangent, input.normal);
 			view_dir = tbn * view_dir;
@@ -426,18 +448,18 @@ namespace Guarneri
 
 		Color ret = Color::BLACK;
 		Color albedo = Color::WHITE;
-		name2tex.count(albedo_prop) > 0 && name2tex.at(albedo_prop)->sample(input.uv.x, input.uv.y, albedo);
+		name2tex.count(albedo_prop) > 0 && name2tex.at(albedo_prop)->sample(input.uv.x, input.uv.y, input.ddx.uv, input.ddy.uv, albedo);
 
-		if (misc_param.color_space == ColorSpace::Linear)
+		if (params->color_space == ColorSpace::Linear)
 		{
 			albedo = Color::pow(albedo, 2.2f);
 		}
 
 		Color ao = Color::WHITE;
-		name2tex.count(ao_prop) > 0 && name2tex.at(ao_prop)->sample(input.uv.x, input.uv.y, ao);
+		name2tex.count(ao_prop) > 0 && name2tex.at(ao_prop)->sample(input.uv.x, input.uv.y, input.ddx.uv, input.ddy.uv, ao);
 
 		Color emmision = Color::BLACK;
-		name2tex.count(emission_prop) > 0 && name2tex.at(emission_prop)->sample(input.uv.x, input.uv.y, emmision);
+		name2tex.count(emission_prop) > 0 && name2tex.at(emission_prop)->sample(input.uv.x, input.uv.y, input.ddx.uv, input.ddy.uv, emmision);
 
 		ret += calculate_main_light(main_light, lighting_param, wpos, view_dir, normal, albedo, ao, input.uv, tbn);
 
@@ -450,63 +472,68 @@ namespace Guarneri
 
 		ret *= shadow_atten;
 
-		// todo: ddx ddy
-		/*if ((misc_param.render_flag & RenderFlag::MIPMAP) != RenderFlag::DISABLE) {
-			Vector2 ddx_uv = ddx.uv;
-			Vector2 ddy_uv = ddy.uv;
-			float rho = std::max(std::sqrt(Vector2::dot(ddx_uv, ddx_uv)), std::sqrt(Vector2::dot(ddy_uv, ddy_uv)));
-			float logrho = std::log2(rho);
-			int mip = std::max(int(logrho + 0.5f), 0);
-			if (mip == 0) {
+		if ((params->render_flag & RenderFlag::MIPMAP) != RenderFlag::DISABLE && name2tex.count(albedo_prop) > 0)
+		{
+			int mip = (int)(name2tex.at(albedo_prop)->lod(input.ddx.uv, input.ddy.uv) + 0.5f);
+			if (mip == 0)
+			{
 				return Color(1.0f, 0.0f, 0.0f, 1.0f);
 			}
-			else if (mip == 1) {
+			else if (mip == 1)
+			{
 				return Color(0.0f, 1.0f, 0.0f, 1.0f);
 			}
-			else if (mip == 2) {
+			else if (mip == 2)
+			{
 				return Color(0.0f, 0.0f, 1.0f, 1.0f);
 			}
-			else if (mip == 3) {
+			else if (mip == 3)
+			{
 				return Color(1.0f, 0.0f, 1.0f, 1.0f);
 			}
-			else if (mip == 4) {
+			else if (mip == 4)
+			{
 				return Color(0.0f, 1.0f, 1.0f, 1.0f);
 			}
-			else if (mip == 5) {
+			else if (mip == 5)
+			{
 				return Color(1.0f, 1.0f, 1.0f, 1.0f);
 			}
-			else if (mip == 6) {
+			else if (mip == 6)
+			{
 				return Color(0.5f, 0.0f, 0.5f, 1.0f);
 			}
-			else if (mip == 7) {
+			else if (mip == 7)
+			{
 				return Color(0.0f, 0.5f, 0.5f, 1.0f);
 			}
-			else {
+			else
+			{
 				return Color(0.5f, 0.5f, 0.5f, 1.0f);
 			}
-		}*/
+		}
 
-		if ((misc_param.render_flag & RenderFlag::SPECULAR) != RenderFlag::DISABLE)
+		if ((params->render_flag & RenderFlag::SPECULAR) != RenderFlag::DISABLE)
 		{
 			return Color(ao.r, ao.r, ao.r, 1.0f);
 		}
 
-		if ((misc_param.render_flag & RenderFlag::UV) != RenderFlag::DISABLE)
+		if ((params->render_flag & RenderFlag::UV) != RenderFlag::DISABLE)
 		{
 			return input.uv;
 		}
 
-		if ((misc_param.render_flag & RenderFlag::VERTEX_COLOR) != RenderFlag::DISABLE)
+		if ((params->render_flag & RenderFlag::VERTEX_COLOR) != RenderFlag::DISABLE)
 		{
 			return input.color;
 		}
 
-		if ((misc_param.render_flag & RenderFlag::NORMAL) != RenderFlag::DISABLE)
+		if ((params->render_flag & RenderFlag::NORMAL) != RenderFlag::DISABLE)
 		{
 			return normal;
 		}
 
-		if (misc_param.color_space == ColorSpace::Linear)
+		if (params->color_space == ColorSpace::Linear)
 		{
 			ret = ret / (ret + Color::WHITE);
 			ret = Color::pow(ret, 1.0f / 2.2f);
@@ -9,6 +9,7 @@ namespace Guarneri
 	public:
 		ShadowShader();
 		~ShadowShader();
+		std::unique_ptr<Shader> clone() const;
 
 	public:
 		v2f vertex_shader(const a2v& input) const;
@@ -20,10 +21,16 @@ namespace Guarneri
 	ShadowShader::ShadowShader()
 	{
 		this->shadow = true;
+		this->varyings = Varying::NONE;
 	}
 	ShadowShader::~ShadowShader()
 	{}
 
+	std::unique_ptr<Shader> ShadowShader::clone() const
+	{
+		return std::make_unique<ShadowShader>(*this);
+	}
+
 	v2f ShadowShader::vertex_shader(const a2v& input) const
 	{
 		v2f o;
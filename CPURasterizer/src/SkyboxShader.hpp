@@ -9,6 +9,7 @@ namespace Guarneri
 	public:
 		SkyboxShader();
 		~SkyboxShader();
+		std::unique_ptr<Shader> clone() const;
 
 	public:
 		v2f vertex_shader(const a2v& input) const;
@@ -20,11 +21,17 @@ namespace Guarneri
 	SkyboxShader::SkyboxShader()
 	{
 		this->skybox = true;
+		this->varyings = Varying::SHADOW_COORD;
 	}
 
 	SkyboxShader::~SkyboxShader()
 	{}
 
+	std::unique_ptr<Shader> SkyboxShader::clone() const
+	{
+		return std::make_unique<SkyboxShader>(*this);
+	}
+
 	v2f SkyboxShader::vertex_shader(const a2v& input) const
 	{
 		v2f o;
@@ -39,7 +46,7 @@ namespace Guarneri
 	{
 		Color sky_color;
 
-		if ((misc_param.render_flag & RenderFlag::UV) != RenderFlag::DISABLE)
+		if ((params->render_flag & RenderFlag::UV) != RenderFlag::DISABLE)
 		{
 			int index;
 			return name2cubemap.at(cubemap_prop)->sample(input.shadow_coord.xyz(), index);
@@ -45,6 +45,8 @@ namespace Guarneri
 		bool point(const float& u, const float& v, Color& ret) const;
 		void generate_mipmap(const int& mip_count, const Filtering& filtering);
 		bool sample(const float& u, const float& v, Color& ret) const;
+		bool sample(const float& u, const float& v, const Vector2& ddx, const Vector2& ddy, Color& ret) const;
+		float lod(const Vector2& ddx, const Vector2& ddy) const;
 		bool read(const float& u, const float& v, Color& ret) const;
 		bool read(const uint32_t& row, const uint32_t& col, Color& ret) const;
 		bool write(const uint32_t& x, const uint32_t& y, const Color& data);
@@ -54,6 +56,17 @@ namespace Guarneri
 		std::string str() const;
 
 	private:
+		bool sample(const float& u, const float& v, const uint32_t& level, Color& ret) const;
+		bool bilinear(const float& u, const float& v, const uint32_t& level, Color& ret) const;
+		bool point(const float& u, const float& v, const uint32_t& level, Color& ret) const;
+		bool read(const float& u, const float& v, const uint32_t& level, Color& ret) const;
+		bool read(const uint32_t& row, const uint32_t& col, const uint32_t& level, Color& ret) const;
+		bool read_quad(const uint32_t& row, const uint32_t& col, const uint32_t& level, Color quad[4]) const;
+		template<typename T>
+		static void read_quad(const RawBuffer<T>& buffer, const uint32_t& row, const uint32_t& col, Color quad[4]);
+		void level_size(const uint32_t& level, uint32_t& w, uint32_t& h) const;
+		template<typename T>
+		static void downsample(const RawBuffer<T>& src, RawBuffer<T>& dst, T(*encode)(const Color& c));
 		//todo:
 		void wrap(float& u, float& v) const;
 		void clear();
@@ -193,6 +206,12 @@ namespace Guarneri
 			{
 				std::cerr << "invalid channels: " << channels << std::endl;
 			}
+
+			if (this->fmt != TextureFormat::INVALID)
+			{
+				int levels = 1 + (int)std::floor(std::log2((float)std::max(w, h)));
+				generate_mipmap(levels, Filtering::POINT);
+			}
 		}
 		std::cout << this->str() << " created" << std::endl;
 	}
@@ -238,8 +257,20 @@ namespace Guarneri
 
 	bool Texture::bilinear(const float& u, const float& v, Color& ret) const
 	{
-		float rf = v * (float)this->width + 0.5f;
-		float cf = u * (float)this->height + 0.5f;
+		return bilinear(u, v, 0, ret);
+	}
+
+	bool Texture::point(const float& u, const float& v, Color& ret) const
+	{
+		return point(u, v, 0, ret);
+	}
+
+	bool Texture::bilinear(const float& u, const float& v, const uint32_t& level, Color& ret) const
+	{
+		uint32_t w, h;
+		level_size(level, w, h);
+		float rf = v * (float)h + 0.5f;
+		float cf = u * (float)w + 0.5f;
 
 		uint32_t row = (uint32_t)std::floor(rf);
 		uint32_t col = (uint32_t)std::floor(cf);
@@ -247,11 +278,19 @@ namespace Guarneri
 		float frac_row = rf - (float)row;
 		float frac_col = cf - (float)col;
 
-		Color c00, c01, c11, c10;
-		read(row, col, c00);
-		read(row + 1, col, c01);
-		read(row + 1, col + 1, c11);
-		read(row, col + 1, c10);
+		// footprints inside the level are fetched unchecked, only the border ones go through read
+		Color quad[4];
+		if (row >= h - 1 || col >= w - 1 || !read_quad(row, col, level, quad))
+		{
+			read(row, col, level, quad[0]);
+			read(row + 1, col, level, quad[1]);
+			read(row + 1, col + 1, level, quad[2]);
+			read(row, col + 1, level, quad[3]);
+		}
+		const Color& c00 = quad[0];
+		const Color& c01 = quad[1];
+		const Color& c11 = quad[2];
+		const Color& c10 = quad[3];
 
 		Color  a = c00 * (1.0f - frac_row) + c10 * frac_row;
 		Color  b = c01 * (1.0f - frac_row) + c11 * frac_row;
@@ -259,85 +298,67 @@ namespace Guarneri
 		return true;
 	}
 
-	bool Texture::point(const float& u, const float& v, Color& ret) const
+	bool Texture::point(const float& u, const float& v, const uint32_t& level, Color& ret) const
 	{
-		read(u, v, ret);
+		read(u, v, level, ret);
 		return true;
 	}
 
+	// box filtered mip chain, level 0 shares the texture buffer
 	void Texture::generate_mipmap(const int& count, const Filtering& mip_filter)
 	{
+		gray_mipmaps.clear();
+		rg_mipmaps.clear();
+		rgb_mipmaps.clear();
+		rgba_mipmaps.clear();
+
 		switch (this->fmt)
 		{
 		case TextureFormat::rgb:
 		{
-			for (int i = 1; i < count; i++)
-			{
-				rgb_mipmaps[i].reset();
-			}
-			rgb_mipmaps.clear();
-
 			rgb_mipmaps.emplace_back(rgb_buffer);
-
 			for (int i = 1; i < count; i++)
 			{
-				long w = this->width >> i;
-				long h = this->height >> i;
+				long w = std::max(this->width >> i, 1u);
+				long h = std::max(this->height >> i, 1u);
 				rgb_mipmaps.emplace_back(std::make_shared<RawBuffer<color_rgb>>(w, h));
+				downsample<color_rgb>(*rgb_mipmaps[i - 1], *rgb_mipmaps[i], [](const Color& c) { return Color::encode_rgb(c); });
 			}
 			break;
 		}
 		case TextureFormat::rgba:
 		{
-			for (int i = 1; i < count; i++)
-			{
-				rgba_mipmaps[i].reset();
-			}
-			rgba_mipmaps.clear();
-
 			rgba_mipmaps.emplace_back(rgba_buffer);
-
 			for (int i = 1; i < count; i++)
 			{
-				long w = this->width >> i;
-				long h = this->height >> i;
+				long w = std::max(this->width >> i, 1u);
+				long h = std::max(this->height >> i, 1u);
 				rgba_mipmaps.emplace_back(std::make_shared<RawBuffer<color_rgba>>(w, h));
+				downsample<color_rgba>(*rgba_mipmaps[i - 1], *rgba_mipmaps[i], [](const Color& c) { return Color::encode_rgba(c); });
 			}
 			break;
 		}
 		case TextureFormat::rg:
 		{
-			for (int i = 1; i < count; i++)
-			{
-				rg_mipmaps[i].reset();
-			}
-			rg_mipmaps.clear();
-
 			rg_mipmaps.emplace_back(rg_buffer);
-
 			for (int i = 1; i < count; i++)
 			{
-				long w = this->width >> i;
-				long h = this->height >> i;
+				long w = std::max(this->width >> i, 1u);
+				long h = std::max(this->height >> i, 1u);
 				rg_mipmaps.emplace_back(std::make_shared<RawBuffer<color_rg>>(w, h));
+				downsample<color_rg>(*rg_mipmaps[i - 1], *rg_mipmaps[i], [](const Color& c) { return Color::encode_rg(c.r, c.g); });
 			}
 			break;
 		}
 		case TextureFormat::r32:
 		{
-			for (int i = 1; i < count; i++)
-			{
-				gray_mipmaps[i].reset();
-			}
-			gray_mipmaps.clear();
-
 			gray_mipmaps.emplace_back(gray_buffer);
-
 			for (int i = 1; i < count; i++)
 			{
-				long w = this->width >> i;
-				long h = this->height >> i;
+				long w = std::max(this->width >> i, 1u);
+				long h = std::max(this->height >> i, 1u);
 				gray_mipmaps.emplace_back(std::make_shared<RawBuffer<color_gray>>(w, h));
+				downsample<color_gray>(*gray_mipmaps[i - 1], *gray_mipmaps[i], [](const Color& c) { return Color::encode_gray(c); });
 			}
 			break;
 		}
@@ -347,54 +368,131 @@ namespace Guarneri
 		this->mip_filtering = mip_filter;
 	}
 
+	template<typename T>
+	void Texture::downsample(const RawBuffer<T>& src, RawBuffer<T>& dst, T(*encode)(const Color& c))
+	{
+		for (uint32_t row = 0; row < dst.height; row++)
+		{
+			uint32_t r0 = std::min(row * 2, src.height - 1);
+			uint32_t r1 = std::min(row * 2 + 1, src.height - 1);
+			for (uint32_t col = 0; col < dst.width; col++)
+			{
+				uint32_t c0 = std::min(col * 2, src.width - 1);
+				uint32_t c1 = std::min(col * 2 + 1, src.width - 1);
+				// coordinates are clamped to src above
+				Color avg = (Color::decode(src.at(r0, c0)) + Color::decode(src.at(r0, c1)) + Color::decode(src.at(r1, c0)) + Color::decode(src.at(r1, c1))) * 0.25f;
+				dst.at(row, col) = encode(avg);
+			}
+		}
+	}
+
 	bool Texture::sample(const float& u, const float& v, Color& ret) const
+	{
+		return sample(u, v, 0, ret);
+	}
+
+	// selects the mip level from screen space uv derivatives
+	bool Texture::sample(const float& u, const float& v, const Vector2& ddx, const Vector2& ddy, Color& ret) const
+	{
+		if (mip_count <= 1)
+		{
+			return sample(u, v, 0, ret);
+		}
+		float level = lod(ddx, ddy);
+		if (mip_filtering == Filtering::BILINEAR)
+		{
+			uint32_t l0 = (uint32_t)level;
+			uint32_t l1 = std::min(l0 + 1, mip_count - 1);
+			float t = level - (float)l0;
+			Color c0, c1;
+			bool ok = sample(u, v, l0, c0);
+			ok = sample(u, v, l1, c1) && ok;
+			ret = c0 * (1.0f - t) + c1 * t;
+			return ok;
+		}
+		return sample(u, v, (uint32_t)(level + 0.5f), ret);
+	}
+
+	float Texture::lod(const Vector2& ddx, const Vector2& ddy) const
+	{
+		if (mip_count <= 1)
+		{
+			return 0.0f;
+		}
+		Vector2 dx = Vector2(ddx.x * (float)width, ddx.y * (float)height);
+		Vector2 dy = Vector2(ddy.x * (float)width, ddy.y * (float)height);
+		float rho2 = std::max(Vector2::dot(dx, dx), Vector2::dot(dy, dy));
+		if (!(rho2 > 1.0f))
+		{
+			return 0.0f;
+		}
+		float level = 0.5f * std::log2(rho2);
+		return std::min(level, (float)(mip_count - 1));
+	}
+
+	bool Texture::sample(const float& u, const float& v, const uint32_t& level, Color& ret) const
 	{
 		switch (this->filtering)
 		{
 		case Filtering::BILINEAR:
-			return bilinear(u, v, ret);
+			return bilinear(u, v, level, ret);
 		case Filtering::POINT:
-			return point(u, v, ret);
+			return point(u, v, level, ret);
 		}
 		return false;
 	}
 
 	bool Texture::read(const float& u, const float& v, Color& ret) const
+	{
+		return read(u, v, 0, ret);
+	}
+
+	bool Texture::read(const uint32_t& row, const uint32_t& col, Color& ret) const
+	{
+		return read(row, col, 0, ret);
+	}
+
+	bool Texture::read(const float& u, const float& v, const uint32_t& level, Color& ret) const
 	{
 		float wu = u;
 		float wv = v;
 		this->wrap(wu, wv);
+		bool mip = level > 0 && level < mip_count;
 		switch (fmt)
 		{
 		case TextureFormat::rgb:
 		{
-			if (rgb_buffer == nullptr) return false;
+			const RawBuffer<color_rgb>* buffer = mip ? rgb_mipmaps[level].get() : rgb_buffer.get();
+			if (buffer == nullptr) return false;
 			color_rgb pixel;
-			bool ok = rgb_buffer->read(wu, wv, pixel);
+			bool ok = buffer->read(wu, wv, pixel);
 			ret = Color::decode(pixel);
 			return ok;
 		}
 		case TextureFormat::rgba:
 		{
-			if (rgba_buffer == nullptr) return false;
+			const RawBuffer<color_rgba>* buffer = mip ? rgba_mipmaps[level].get() : rgba_buffer.get();
+			if (buffer == nullptr) return false;
 			color_rgba pixel;
-			bool ok = rgba_buffer->read(wu, wv, pixel);
+			bool ok = buffer->read(wu, wv, pixel);
 			ret = Color::decode(pixel);
 			return ok;
 		}
 		case TextureFormat::rg:
 		{
-			if (rg_buffer == nullptr) return false;
+			const RawBuffer<color_rg>* buffer = mip ? rg_mipmaps[level].get() : rg_buffer.get();
+			if (buffer == nullptr) return false;
 			color_rg pixel;
-			bool ok = rg_buffer->read(wu, wv, pixel);
+			bool ok = buffer->read(wu, wv, pixel);
 			ret = Color::decode(pixel);
 			return ok;
 		}
 		case TextureFormat::r32:
 		{
-			if (gray_buffer == nullptr) return false;
+			const RawBuffer<color_gray>* buffer = mip ? gray_mipmaps[level].get() : gray_buffer.get();
+			if (buffer == nullptr) return false;
 			color_gray pixel;
-			bool ok = gray_buffer->read(wu, wv, pixel);
+			bool ok = buffer->read(wu, wv, pixel);
 			ret = Color::decode(pixel);
 			return ok;
 		}
@@ -402,39 +500,44 @@ namespace Guarneri
 		return false;
 	}
 
-	bool Texture::read(const uint32_t& row, const uint32_t& col, Color& ret) const
+	bool Texture::read(const uint32_t& row, const uint32_t& col, const uint32_t& level, Color& ret) const
 	{
+		bool mip = level > 0 && level < mip_count;
 		switch (fmt)
 		{
 		case TextureFormat::rgb:
 		{
-			if (rgb_buffer == nullptr) return false;
+			const RawBuffer<color_rgb>* buffer = mip ? rgb_mipmaps[level].get() : rgb_buffer.get();
+			if (buffer == nullptr) return false;
 			color_rgb pixel;
-			bool ok = rgb_buffer->read(row, col, pixel);
+			bool ok = buffer->read(row, col, pixel);
 			ret = Color::decode(pixel);
 			return ok;
 		}
 		case TextureFormat::rgba:
 		{
-			if (rgba_buffer == nullptr) return false;
+			const RawBuffer<color_rgba>* buffer = mip ? rgba_mipmaps[level].get() : rgba_buffer.get();
+			if (buffer == nullptr) return false;
 			color_rgba pixel;
-			bool ok = rgba_buffer->read(row, col, pixel);
+			bool ok = buffer->read(row, col, pixel);
 			ret = Color::decode(pixel);
 			return ok;
 		}
 		case TextureFormat::rg:
 		{
-			if (rg_buffer == nullptr) return false;
+			const RawBuffer<color_rg>* buffer = mip ? rg_mipmaps[level].get() : rg_buffer.get();
+			if (buffer == nullptr) return false;
 			color_rg pixel;
-			bool ok = rg_buffer->read(row, col, pixel);
+			bool ok = buffer->read(row, col, pixel);
 			ret = Color::decode(pixel);
 			return ok;
 		}
 		case TextureFormat::r32:
 		{
-			if (gray_buffer == nullptr) return false;
+			const RawBuffer<color_gray>* buffer = mip ? gray_mipmaps[level].get() : gray_buffer.get();
+			if (buffer == nullptr) return false;
 			color_gray pixel;
-			bool ok = gray_buffer->read(row, col, pixel);
+			bool ok = buffer->read(row, col, pixel);
 			ret = Color::decode(pixel);
 			return ok;
 		}
@@ -442,6 +545,60 @@ namespace Guarneri
 		return false;
 	}
 
+	// (row, col), (row + 1, col), (row + 1, col + 1) and (row, col + 1), all of them must lie inside the level
+	bool Texture::read_quad(const uint32_t& row, const uint32_t& col, const uint32_t& level, Color quad[4]) const
+	{
+		bool mip = level > 0 && level < mip_count;
+		switch (fmt)
+		{
+		case TextureFormat::rgb:
+		{
+			const RawBuffer<color_rgb>* buffer = mip ? rgb_mipmaps[level].get() : rgb_buffer.get();
+			if (buffer == nullptr) return false;
+			read_quad(*buffer, row, col, quad);
+			return true;
+		}
+		case TextureFormat::rgba:
+		{
+			const RawBuffer<color_rgba>* buffer = mip ? rgba_mipmaps[level].get() : rgba_buffer.get();
+			if (buffer == nullptr) return false;
+			read_quad(*buffer, row, col, quad);
+			return true;
+		}
+		case TextureFormat::rg:
+		{
+			const RawBuffer<color_rg>* buffer = mip ? rg_mipmaps[level].get() : rg_buffer.get();
+			if (buffer == nullptr) return false;
+			read_quad(*buffer, row, col, quad);
+			return true;
+		}
+		case TextureFormat::r32:
+		{
+			const RawBuffer<color_gray>* buffer = mip ? gray_mipmaps[level].get() : gray_buffer.get();
+			if (buffer == nullptr) return false;
+			read_quad(*buffer, row, col, quad);
+			return true;
+		}
+		}
+		return false;
+	}
+
+	template<typename T>
+	void Texture::read_quad(const RawBuffer<T>& buffer, const uint32_t& row, const uint32_t& col, Color quad[4])
+	{
+		quad[0] = Color::decode(buffer.at(row, col));
+		quad[1] = Color::decode(buffer.at(row + 1, col));
+		quad[2] = Color::decode(buffer.at(row + 1, col + 1));
+		quad[3] = Color::decode(buffer.at(row, col + 1));
+	}
+
+	void Texture::level_size(const uint32_t& level, uint32_t& w, uint32_t& h) const
+	{
+		uint32_t l = level < mip_count ? level : 0;
+		w = std::max(this->width >> l, 1u);
+		h = std::max(this->height >> l, 1u);
+	}
+
 	bool Texture::write(const uint32_t& x, const uint32_t& y, const Color& data)
 	{
 		switch (fmt)
@@ -605,6 +762,9 @@ namespace Guarneri
 		this->wrap_mode = other.wrap_mode;
 		this->filtering = other.filtering;
 		this->fmt = other.fmt;
+		this->width = other.width;
+		this->height = other.height;
+		this->mip_filtering = other.mip_filtering;
 		this->rgba_buffer = other.rgba_buffer;
 		this->rgb_buffer = other.rgb_buffer;
 		this->gray_buffer = other.gray_buffer;
@@ -0,0 +1,394 @@
+#ifndef _TRIANGLE_SETUP_
+#define _TRIANGLE_SETUP_
+#include <CPURasterizer.hpp>
+
+namespace Guarneri
+{
+	// E(x, y) = a * x + b * y + c, coordinates in sub-pixel units
+	struct EdgeFunction
+	{
+	public:
+		int64_t a;
+		int64_t b;
+		int64_t c;
+		// top-left fill rule, 0 for top/left edges, 1 otherwise
+		int64_t bias;
+		// increments per pixel
+		int64_t step_x;
+		int64_t step_y;
+
+	public:
+		EdgeFunction();
+		void setup(const int64_t& x0, const int64_t& y0, const int64_t& x1, const int64_t& y1);
+		int64_t evaluate(const int64_t& x, const int64_t& y) const;
+		bool is_top_left() const;
+	};
+
+
+	// attribute planes in barycentric form: f = base + d1 * w1 + d2 * w2,
+	// only position, rhw and the varyings consumed by the shader are stored
+	struct VaryingPlanes
+	{
+	public:
+		Varying varyings;
+		int count;
+		float base[MAX_VARYING_FLOATS];
+		float d1[MAX_VARYING_FLOATS];
+		float d2[MAX_VARYING_FLOATS];
+
+	public:
+		VaryingPlanes();
+		void setup(const Vertex& v0, const Vertex& v1, const Vertex& v2, const Varying& _varyings);
+		void evaluate(const float& w1, const float& w2, v2f& out) const;
+		static v2f_attributes derivative(const v2f_attributes& from, const v2f_attributes& to);
+
+	private:
+		static int pack(const Vertex& v, const Varying& varyings, float* out);
+	};
+
+
+	// per triangle rasterization data, computed once and shared by every tile the triangle overlaps
+	struct TriangleSetup
+	{
+	public:
+		// edge i is opposite to vertex ccw_idx[i]
+		EdgeFunction edges[3];
+		uint32_t ccw_idx[3];
+		int64_t area;
+		float inv_area;
+		int row_start;
+		int row_end;
+		int col_start;
+		int col_end;
+		// edge values stay below 2^51, required by the SIMD kernels
+		bool fits_simd;
+		// screen space z of the ccw vertices
+		float z[3];
+		// depth range of the vertices
+		float min_z;
+		float max_z;
+		VaryingPlanes planes;
+
+	public:
+		TriangleSetup();
+		bool initialize(const Triangle& tri, const Varying& varyings);
+		void barycentric(const int& row, const int& col, float& w1, float& w2) const;
+		BlockCoverage classify_block(const int& row_start, const int& row_end, const int& col_start, const int& col_end) const;
+		float min_depth(const int& row_start, const int& row_end, const int& col_start, const int& col_end) const;
+		static int64_t to_fixed(const float& v);
+	};
+
+
+	EdgeFunction::EdgeFunction()
+	{
+		a = 0;
+		b = 0;
+		c = 0;
+		bias = 0;
+		step_x = 0;
+		step_y = 0;
+	}
+
+	// same sign convention as Triangle::area_double(v0, v1, pixel)
+	void EdgeFunction::setup(const int64_t& x0, const int64_t& y0, const int64_t& x1, const int64_t& y1)
+	{
+		a = y1 - y0;
+		b = x0 - x1;
+		c = -(a * x0 + b * y0);
+		bias = is_top_left() ? 0 : 1;
+		// samples exactly on a non top-left edge are rejected by the >= 0 test
+		c -= bias;
+		step_x = a * SUBPIXEL_ONE;
+		step_y = b * SUBPIXEL_ONE;
+	}
+
+	int64_t EdgeFunction::evaluate(const int64_t& x, const int64_t& y) const
+	{
+		return a * x + b * y + c;
+	}
+
+	// screen space is y-up, inside is E >= 0:
+	// left edges go upward (a > 0), top edges are horizontal and go leftward (b < 0)
+	bool EdgeFunction::is_top_left() const
+	{
+		return a > 0 || (a == 0 && b < 0);
+	}
+
+	VaryingPlanes::VaryingPlanes()
+	{
+		varyings = Varying::NONE;
+		count = 0;
+	}
+
+	void VaryingPlanes::setup(const Vertex& v0, const Vertex& v1, const Vertex& v2, const Varying& _varyings)
+	{
+		float f0[MAX_VARYING_FLOATS], f1[MAX_VARYING_FLOATS], f2[MAX_VARYING_FLOATS];
+		this->varyings = _varyings;
+		this->count = pack(v0, _varyings, f0);
+		pack(v1, _varyings, f1);
+		pack(v2, _varyings, f2);
+		for (int i = 0; i < count; i++)
+		{
+			base[i] = f0[i];
+			d1[i] = f1[i] - f0[i];
+			d2[i] = f2[i] - f0[i];
+		}
+	}
+
+	// attributes were divided by w in perspective_division, multiply it back here
+	void VaryingPlanes::evaluate(const float& w1, const float& w2, v2f& out) const
+	{
+		float f[MAX_VARYING_FLOATS];
+		for (int i = 0; i < count; i++)
+		{
+			f[i] = base[i] + d1[i] * w1 + d2[i] * w2;
+		}
+
+		out.position = Vector4(f[0], f[1], f[2], f[3]);
+		if (varyings == Varying::NONE)
+		{
+			return;
+		}
+
+		float w = 1.0f / f[4];
+		int idx = 5;
+		if ((varyings & Varying::WORLD_POS) != Varying::NONE)
+		{
+			out.world_pos = Vector3(f[idx], f[idx + 1], f[idx + 2]) * w;
+			idx += 3;
+		}
+		if ((varyings & Varying::SHADOW_COORD) != Varying::NONE)
+		{
+			out.shadow_coord = Vector4(f[idx], f[idx + 1], f[idx + 2], f[idx + 3]) * w;
+			idx += 4;
+		}
+		if ((varyings & Varying::COLOR) != Varying::NONE)
+		{
+			out.color = Vector4(f[idx], f[idx + 1], f[idx + 2], f[idx + 3]) * w;
+			idx += 4;
+		}
+		if ((varyings & Varying::NORMAL) != Varying::NONE)
+		{
+			out.normal = Vector3(f[idx], f[idx + 1], f[idx + 2]) * w;
+			idx += 3;
+		}
+		if ((varyings & Varying::UV) != Varying::NONE)
+		{
+			out.uv = Vector2(f[idx], f[idx + 1]) * w;
+			idx += 2;
+		}
+		if ((varyings & Varying::TANGENT) != Varying::NONE)
+		{
+			out.tangent = Vector3(f[idx], f[idx + 1], f[idx + 2]) * w;
+			idx += 3;
+		}
+		if ((varyings & Varying::BITANGENT) != Varying::NONE)
+		{
+			out.bitangent = Vector3(f[idx], f[idx + 1], f[idx + 2]) * w;
+			idx += 3;
+		}
+	}
+
+	v2f_attributes VaryingPlanes::derivative(const v2f_attributes& from, const v2f_attributes& to)
+	{
+		v2f_attributes ret;
+		ret.position = to.position - from.position;
+		ret.world_pos = to.world_pos - from.world_pos;
+		ret.uv = to.uv - from.uv;
+		ret.color = to.color - from.color;
+		ret.tangent = to.tangent - from.tangent;
+		ret.bitangent = to.bitangent - from.bitangent;
+		ret.normal = to.normal - from.normal;
+		ret.shadow_coord = to.shadow_coord - from.shadow_coord;
+		return ret;
+	}
+
+	// same order as evaluate
+	int VaryingPlanes::pack(const Vertex& v, const Varying& varyings, float* out)
+	{
+		int idx = 0;
+		out[idx++] = v.position.x;
+		out[idx++] = v.position.y;
+		out[idx++] = v.position.z;
+		out[idx++] = v.position.w;
+		if (varyings == Varying::NONE)
+		{
+			return idx;
+		}
+		out[idx++] = v.rhw;
+		if ((varyings & Varying::WORLD_POS) != Varying::NONE)
+		{
+			out[idx++] = v.world_pos.x;
+			out[idx++] = v.world_pos.y;
+			out[idx++] = v.world_pos.z;
+		}
+		if ((varyings & Varying::SHADOW_COORD) != Varying::NONE)
+		{
+			out[idx++] = v.shadow_coord.x;
+			out[idx++] = v.shadow_coord.y;
+			out[idx++] = v.shadow_coord.z;
+			out[idx++] = v.shadow_coord.w;
+		}
+		if ((varyings & Varying::COLOR) != Varying::NONE)
+		{
+			out[idx++] = v.color.x;
+			out[idx++] = v.color.y;
+			out[idx++] = v.color.z;
+			out[idx++] = v.color.w;
+		}
+		if ((varyings & Varying::NORMAL) != Varying::NONE)
+		{
+			out[idx++] = v.normal.x;
+			out[idx++] = v.normal.y;
+			out[idx++] = v.normal.z;
+		}
+		if ((varyings & Varying::UV) != Varying::NONE)
+		{
+			out[idx++] = v.uv.x;
+			out[idx++] = v.uv.y;
+		}
+		if ((varyings & Varying::TANGENT) != Varying::NONE)
+		{
+			out[idx++] = v.tangent.x;
+			out[idx++] = v.tangent.y;
+			out[idx++] = v.tangent.z;
+		}
+		if ((varyings & Varying::BITANGENT) != Varying::NONE)
+		{
+			out[idx++] = v.bitangent.x;
+			out[idx++] = v.bitangent.y;
+			out[idx++] = v.bitangent.z;
+		}
+		return idx;
+	}
+
+	TriangleSetup::TriangleSetup()
+	{
+		area = 0;
+		inv_area = 0.0f;
+		ccw_idx[0] = 0;
+		ccw_idx[1] = 1;
+		ccw_idx[2] = 2;
+		row_start = 0;
+		row_end = 0;
+		col_start = 0;
+		col_end = 0;
+		fits_simd = false;
+		z[0] = z[1] = z[2] = 0.0f;
+		min_z = 0.0f;
+		max_z = 0.0f;
+	}
+
+	int64_t TriangleSetup::to_fixed(const float& v)
+	{
+		float clamped = CLAMP_FLT(v, -SUBPIXEL_MAX_COORD, SUBPIXEL_MAX_COORD);
+		return (int64_t)std::floor((double)clamped * SUBPIXEL_ONE + 0.5);
+	}
+
+	// returns false for degenerated triangles
+	bool TriangleSetup::initialize(const Triangle& tri, const Varying& varyings)
+	{
+		const int64_t simd_limit = (int64_t)1 << 23;
+		int64_t x[3], y[3];
+		fits_simd = true;
+		for (int i = 0; i < 3; i++)
+		{
+			x[i] = to_fixed(tri[i].position.x);
+			y[i] = to_fixed(tri[i].position.y);
+			fits_simd = fits_simd && std::abs(x[i]) < simd_limit && std::abs(y[i]) < simd_limit;
+		}
+
+		area = (x[2] - x[0]) * (y[1] - y[0]) - (y[2] - y[0]) * (x[1] - x[0]);
+		if (area == 0)
+		{
+			return false;
+		}
+
+		// normalize winding so that inside is always E >= 0
+		ccw_idx[0] = 0;
+		ccw_idx[1] = area > 0 ? 1 : 2;
+		ccw_idx[2] = area > 0 ? 2 : 1;
+		area = area > 0 ? area : -area;
+		inv_area = (float)(1.0 / (double)area);
+
+		uint32_t i0 = ccw_idx[0], i1 = ccw_idx[1], i2 = ccw_idx[2];
+		edges[0].setup(x[i1], y[i1], x[i2], y[i2]);
+		edges[1].setup(x[i2], y[i2], x[i0], y[i0]);
+		edges[2].setup(x[i0], y[i0], x[i1], y[i1]);
+
+		planes.setup(tri[i0], tri[i1], tri[i2], varyings);
+
+		z[0] = tri[i0].position.z;
+		z[1] = tri[i1].position.z;
+		z[2] = tri[i2].position.z;
+		min_z = std::min(z[0], std::min(z[1], z[2]));
+		max_z = std::max(z[0], std::max(z[1], z[2]));
+
+		// pixels whose centers lie inside the fixed-point bounds
+		int64_t min_x = std::min(x[0], std::min(x[1], x[2]));
+		int64_t max_x = std::max(x[0], std::max(x[1], x[2]));
+		int64_t min_y = std::min(y[0], std::min(y[1], y[2]));
+		int64_t max_y = std::max(y[0], std::max(y[1], y[2]));
+		col_start = (int)((min_x - SUBPIXEL_HALF + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS);
+		col_end = (int)((max_x - SUBPIXEL_HALF) >> SUBPIXEL_BITS) + 1;
+		row_start = (int)((min_y - SUBPIXEL_HALF + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS);
+		row_end = (int)((max_y - SUBPIXEL_HALF) >> SUBPIXEL_BITS) + 1;
+		return true;
+	}
+
+	// weights of the second and third ccw vertices at a pixel center, same as the span kernels produce
+	void TriangleSetup::barycentric(const int& row, const int& col, float& w1, float& w2) const
+	{
+		int64_t x = ((int64_t)col << SUBPIXEL_BITS) + SUBPIXEL_HALF;
+		int64_t y = ((int64_t)row << SUBPIXEL_BITS) + SUBPIXEL_HALF;
+		w1 = (float)(edges[1].evaluate(x, y) + edges[1].bias) * inv_area;
+		w2 = (float)(edges[2].evaluate(x, y) + edges[2].bias) * inv_area;
+	}
+
+	// tests the pixel centers of [row_start, row_end) x [col_start, col_end) against all edges at once,
+	// edge functions are linear so checking the extreme corner of each edge is enough
+	BlockCoverage TriangleSetup::classify_block(const int& row_start, const int& row_end, const int& col_start, const int& col_end) const
+	{
+		int64_t x0 = ((int64_t)col_start << SUBPIXEL_BITS) + SUBPIXEL_HALF;
+		int64_t x1 = ((int64_t)(col_end - 1) << SUBPIXEL_BITS) + SUBPIXEL_HALF;
+		int64_t y0 = ((int64_t)row_start << SUBPIXEL_BITS) + SUBPIXEL_HALF;
+		int64_t y1 = ((int64_t)(row_end - 1) << SUBPIXEL_BITS) + SUBPIXEL_HALF;
+		bool inside = true;
+		for (int i = 0; i < 3; i++)
+		{
+			const EdgeFunction& e = edges[i];
+			int64_t max_val = e.evaluate(e.a >= 0 ? x1 : x0, e.b >= 0 ? y1 : y0);
+			if (max_val < 0)
+			{
+				return BlockCoverage::OUTSIDE;
+			}
+			int64_t min_val = e.evaluate(e.a >= 0 ? x0 : x1, e.b >= 0 ? y0 : y1);
+			if (min_val < 0)
+			{
+				inside = false;
+			}
+		}
+		return inside ? BlockCoverage::INSIDE : BlockCoverage::PARTIAL;
+	}
+
+	// lower bound of the triangle depth over the pixel centers of [row_start, row_end) x [col_start, col_end),
+	// z is linear in screen space so the minimum of the plane lies on a corner
+	float TriangleSetup::min_depth(const int& row_start, const int& row_end, const int& col_start, const int& col_end) const
+	{
+		float depth = FLT_MAX;
+		const int rows[2] = { row_start, row_end - 1 };
+		const int cols[2] = { col_start, col_end - 1 };
+		for (int r = 0; r < 2; r++)
+		{
+			for (int c = 0; c < 2; c++)
+			{
+				float w1, w2;
+				barycentric(rows[r], cols[c], w1, w2);
+				depth = std::min(depth, z[0] + (z[1] - z[0]) * w1 + (z[2] - z[0]) * w2);
+			}
+		}
+		// the plane is unbounded outside the triangle, vertices bound it from below
+		return std::max(depth, min_z);
+	}
+}
+#endif
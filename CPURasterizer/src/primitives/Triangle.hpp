@@ -17,7 +17,7 @@ namespace Guarneri
 		Triangle(const Vertex& v1, const Vertex& v2, const Vertex& v3);
 		Triangle(const Vertex& v1, const Vertex& v2, const Vertex& v3, const bool& flip);
 		void interpolate(const float& screen_y, Vertex& lhs, Vertex& rhs) const;
-		std::vector<Triangle> horizontally_split() const;
+		size_t horizontally_split(Triangle out[2]) const;
 		float area() const;
 		float area_double() const;
 		static float area_double(const Vector2& v1, const Vector2& v2, const Vector2& v3);
@@ -117,15 +117,11 @@ namespace Guarneri
 		//        \/
 		//	    bottom[0]
 		//====================================================
-	std::vector<Triangle> Triangle::horizontally_split() const
+	// writes at most two flat triangles to out, returns how many
+	size_t Triangle::horizontally_split(Triangle out[2]) const
 	{
-		std::vector<Triangle> ret;
-
-		std::vector<Vertex> sorted;
-		sorted.emplace_back(vertices[0]);
-		sorted.emplace_back(vertices[1]);
-		sorted.emplace_back(vertices[2]);
-		std::sort(sorted.begin(), sorted.end(), [](const Vertex& lhs, const Vertex& rhs)
+		Vertex sorted[3] = { vertices[0], vertices[1], vertices[2] };
+		std::sort(sorted, sorted + 3, [](const Vertex& lhs, const Vertex& rhs)
 		{
 			return lhs.position.y < rhs.position.y;
 		});
@@ -136,7 +132,7 @@ namespace Guarneri
 		// Line
 		if (sorted[0].position.y == sorted[1].position.y && sorted[1].position.y == sorted[2].position.y)
 		{
-			return ret;
+			return 0;
 		}
 
 		// top Triangle
@@ -144,13 +140,13 @@ namespace Guarneri
 		{
 			if (sorted[1].position.x >= sorted[2].position.x)
 			{
-				ret.emplace_back(Triangle(sorted[0], sorted[2], sorted[1]));
+				out[0] = Triangle(sorted[0], sorted[2], sorted[1]);
 			}
 			else
 			{
-				ret.emplace_back(Triangle(sorted[0], sorted[1], sorted[2]));
+				out[0] = Triangle(sorted[0], sorted[1], sorted[2]);
 			}
-			return ret;
+			return 1;
 		}
 
 		// bottom Triangle
@@ -158,13 +154,13 @@ namespace Guarneri
 		{
 			if (sorted[0].position.x >= sorted[1].position.x)
 			{
-				ret.emplace_back(Triangle(sorted[2], sorted[1], sorted[0], true));
+				out[0] = Triangle(sorted[2], sorted[1], sorted[0], true);
 			}
 			else
 			{
-				ret.emplace_back(Triangle(sorted[2], sorted[0], sorted[1], true));
+				out[0] = Triangle(sorted[2], sorted[0], sorted[1], true);
 			}
-			return ret;
+			return 1;
 		}
 
 		// split triangles
@@ -178,24 +174,24 @@ namespace Guarneri
 		// top Triangle: top-left-right
 		if (v.position.x >= sorted[1].position.x)
 		{
-			ret.emplace_back(Triangle(sorted[0], sorted[1], v));
+			out[0] = Triangle(sorted[0], sorted[1], v);
 		}
 		else
 		{
-			ret.emplace_back(Triangle(sorted[0], v, sorted[1]));
+			out[0] = Triangle(sorted[0], v, sorted[1]);
 		}
 
 		// bottom Triangle: bottom-left-right
 		if (v.position.x >= sorted[1].position.x)
 		{
-			ret.emplace_back(Triangle(sorted[2], sorted[1], v, true));
+			out[1] = Triangle(sorted[2], sorted[1], v, true);
 		}
 		else
 		{
-			ret.emplace_back(Triangle(sorted[2], v, sorted[1], true));
+			out[1] = Triangle(sorted[2], v, sorted[1], true);
 		}
 
-		return ret;
+		return 2;
 	}
 
 	float Triangle::area() const
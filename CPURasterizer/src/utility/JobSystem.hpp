@@ -0,0 +1,520 @@
+#ifndef _JOB_SYSTEM_
+#define _JOB_SYSTEM_
+
+// jobs a single queue holds before submitters run them inline, pinned jobs wait for room instead
+#define JOB_QUEUE_CAPACITY 4096
+
+namespace Guarneri
+{
+	// where workers run, the calling thread is never pinned
+	enum class AffinityPolicy
+	{
+		// the os scheduler moves workers freely
+		NONE,
+		// workers fill the processors of one numa node before moving on to the next
+		COMPACT,
+		// consecutive workers alternate between numa nodes
+		SCATTER
+	};
+
+
+	// counts unfinished jobs, a fence is reached when it drops to zero
+	struct JobCounter
+	{
+		std::atomic<uint32_t> pending;
+
+		JobCounter() : pending(0) {}
+		bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+	};
+
+
+	// a range of work, the context outlives the job because submitters always wait on the counter
+	struct Job
+	{
+		void (*function)(void* context, size_t start, size_t end);
+		void* context;
+		size_t start;
+		size_t end;
+		JobCounter* counter;
+		// task graph edge, the job is not started before this counter is done
+		const JobCounter* dependency;
+		// only the worker owning the queue runs it, thieves leave it alone
+		bool pinned;
+	};
+
+
+	// fixed capacity deque, the owner works on the back and thieves take from the front
+	class WorkQueue
+	{
+	private:
+		std::vector<Job> jobs;
+		size_t head;
+		size_t count;
+		std::mutex queue_mutex;
+
+	public:
+		WorkQueue(const size_t& capacity);
+		bool push(const Job& job);
+		bool push_front(const Job& job);
+		bool pop(Job& job);
+		bool steal(Job& job);
+	};
+
+
+	// persistent workers owned by the device, created once instead of per draw call or frame
+	class JobSystem
+	{
+	private:
+		std::vector<std::thread> workers;
+		// one queue per worker plus one for threads outside the system
+		std::vector<std::unique_ptr<WorkQueue>> queues;
+		// queued jobs any thread may take, and queued jobs pinned to each worker, idle workers sleep while both are zero
+		std::atomic<uint32_t> stealable_jobs;
+		std::unique_ptr<std::atomic<uint32_t>[]> pinned_jobs;
+		// jobs taken before their dependency was reached, kept out of the queues until a counter is reached
+		std::vector<Job> parked;
+		std::atomic<uint32_t> parked_count;
+		std::mutex parked_mutex;
+		std::mutex sleep_mutex;
+		std::condition_variable wake_condition;
+		bool stop;
+		// placement the os gave every worker, restored when pinning is turned off
+		std::vector<GROUP_AFFINITY> default_affinity;
+
+	public:
+		JobSystem(const size_t& worker_count);
+		~JobSystem();
+		size_t worker_count() const;
+		size_t thread_index() const;
+		void set_affinity(const AffinityPolicy& policy);
+		void submit(void (*function)(void*, size_t, size_t), void* context, const size_t& start, const size_t& end, JobCounter& counter, const JobCounter* dependency = nullptr);
+		void submit_to(const size_t& worker, void (*function)(void*, size_t, size_t), void* context, const size_t& start, const size_t& end, JobCounter& counter);
+		template <typename F>
+		void parallel_for(const size_t& count, const size_t& grain, const F& body);
+		void wait(const JobCounter& fence);
+
+	private:
+		static std::vector<GROUP_AFFINITY> processor_order(const AffinityPolicy& policy);
+		bool try_execute();
+		bool park(const Job& job);
+		void release_parked();
+		void wake_workers();
+		void execute(const Job& job);
+		void worker_loop(const size_t& index);
+	};
+
+
+	// index of the calling worker, workers.size() for any other thread
+	static thread_local size_t job_worker_index = SIZE_MAX;
+
+	WorkQueue::WorkQueue(const size_t& capacity) : jobs(capacity)
+	{
+		head = 0;
+		count = 0;
+	}
+
+	bool WorkQueue::push(const Job& job)
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		if (count == jobs.size())
+		{
+			return false;
+		}
+		jobs[(head + count) % jobs.size()] = job;
+		count++;
+		return true;
+	}
+
+	bool WorkQueue::push_front(const Job& job)
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		if (count == jobs.size())
+		{
+			return false;
+		}
+		head = (head + jobs.size() - 1) % jobs.size();
+		jobs[head] = job;
+		count++;
+		return true;
+	}
+
+	bool WorkQueue::pop(Job& job)
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		if (count == 0)
+		{
+			return false;
+		}
+		count--;
+		job = jobs[(head + count) % jobs.size()];
+		return true;
+	}
+
+	// the oldest job not pinned to the owner, pinned jobs in front of it keep their order
+	bool WorkQueue::steal(Job& job)
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		for (size_t offset = 0; offset < count; offset++)
+		{
+			if (jobs[(head + offset) % jobs.size()].pinned)
+			{
+				continue;
+			}
+			job = jobs[(head + offset) % jobs.size()];
+			for (size_t shift = offset; shift > 0; shift--)
+			{
+				jobs[(head + shift) % jobs.size()] = jobs[(head + shift - 1) % jobs.size()];
+			}
+			head = (head + 1) % jobs.size();
+			count--;
+			return true;
+		}
+		return false;
+	}
+
+	JobSystem::JobSystem(const size_t& worker_count)
+	{
+		stop = false;
+		stealable_jobs = 0;
+		pinned_jobs = std::make_unique<std::atomic<uint32_t>[]>(worker_count + 1);
+		parked.reserve(JOB_QUEUE_CAPACITY);
+		parked_count = 0;
+		for (size_t idx = 0; idx <= worker_count; idx++)
+		{
+			queues.emplace_back(std::make_unique<WorkQueue>(JOB_QUEUE_CAPACITY));
+			pinned_jobs[idx] = 0;
+		}
+		for (size_t idx = 0; idx < worker_count; idx++)
+		{
+			workers.emplace_back([this, idx] { worker_loop(idx); });
+		}
+	}
+
+	JobSystem::~JobSystem()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+			stop = true;
+		}
+		wake_condition.notify_all();
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	size_t JobSystem::worker_count() const
+	{
+		return workers.size();
+	}
+
+	// the calling worker's index, worker_count() for any other thread
+	size_t JobSystem::thread_index() const
+	{
+		return job_worker_index < workers.size() ? job_worker_index : workers.size();
+	}
+
+	void JobSystem::submit(void (*function)(void*, size_t, size_t), void* context, const size_t& start, const size_t& end, JobCounter& counter, const JobCounter* dependency)
+	{
+		Job job = { function, context, start, end, &counter, dependency, false };
+		counter.pending.fetch_add(1, std::memory_order_relaxed);
+		stealable_jobs.fetch_add(1, std::memory_order_release);
+		// a full queue degrades to running the job right here, unless it still has to wait for its dependency
+		if (!queues[thread_index()]->push(job))
+		{
+			stealable_jobs.fetch_sub(1, std::memory_order_relaxed);
+			if (dependency != nullptr)
+			{
+				wait(*dependency);
+			}
+			execute(job);
+			return;
+		}
+		{
+			// taken so a worker cannot miss the notification between its check and its wait
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+		}
+		wake_condition.notify_one();
+	}
+
+	// runs the job on the given worker, for work whose placement matters such as first touching memory
+	void JobSystem::submit_to(const size_t& worker, void (*function)(void*, size_t, size_t), void* context, const size_t& start, const size_t& end, JobCounter& counter)
+	{
+		assert(worker < workers.size());
+		Job job = { function, context, start, end, &counter, nullptr, true };
+		counter.pending.fetch_add(1, std::memory_order_relaxed);
+		pinned_jobs[worker].fetch_add(1, std::memory_order_release);
+		// never run elsewhere, that would break the placement. a full queue is drained by its owner,
+		// the submitter takes other jobs meanwhile
+		while (!queues[worker]->push(job))
+		{
+			wake_workers();
+			if (!try_execute())
+			{
+				std::this_thread::yield();
+			}
+		}
+		// any other worker woken instead could not take the job, it goes back to sleep right away
+		wake_workers();
+	}
+
+	void JobSystem::wake_workers()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+		}
+		wake_condition.notify_all();
+	}
+
+	// pins worker i to the (i + 1)th processor of the policy's order, the first one is left to the calling thread.
+	// processors are addressed by group and mask, so hosts with more than 64 logical processors are covered too
+	void JobSystem::set_affinity(const AffinityPolicy& policy)
+	{
+		if (default_affinity.empty())
+		{
+			for (auto& worker : workers)
+			{
+				GROUP_AFFINITY affinity = {};
+				GetThreadGroupAffinity(worker.native_handle(), &affinity);
+				default_affinity.push_back(affinity);
+			}
+		}
+		std::vector<GROUP_AFFINITY> processors = processor_order(policy);
+		for (size_t idx = 0; idx < workers.size(); idx++)
+		{
+			const GROUP_AFFINITY& affinity = processors.empty() ? default_affinity[idx] : processors[(idx + 1) % processors.size()];
+			if (affinity.Mask != 0)
+			{
+				SetThreadGroupAffinity(workers[idx].native_handle(), &affinity, nullptr);
+			}
+		}
+	}
+
+	// single processor affinities in placement order, empty for no pinning.
+	// the process mask only describes a single group, so it only restricts the processors on single group hosts
+	std::vector<GROUP_AFFINITY> JobSystem::processor_order(const AffinityPolicy& policy)
+	{
+		std::vector<GROUP_AFFINITY> order;
+		auto processor_affinities = [](const WORD& group, const KAFFINITY& node_mask)
+		{
+			std::vector<GROUP_AFFINITY> processors;
+			for (size_t bit = 0; bit < sizeof(KAFFINITY) * 8; bit++)
+			{
+				KAFFINITY mask = (KAFFINITY)1 << bit;
+				if ((node_mask & mask) != 0)
+				{
+					GROUP_AFFINITY affinity = {};
+					affinity.Mask = mask;
+					affinity.Group = group;
+					processors.push_back(affinity);
+				}
+			}
+			return processors;
+		};
+		if (policy == AffinityPolicy::NONE)
+		{
+			return order;
+		}
+		bool single_group = GetActiveProcessorGroupCount() <= 1;
+		DWORD_PTR process_mask = 0, system_mask = 0;
+		if (single_group && !GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+		{
+			return order;
+		}
+		ULONG highest_node = 0;
+		if (!GetNumaHighestNodeNumber(&highest_node))
+		{
+			highest_node = 0;
+		}
+		std::vector<std::vector<GROUP_AFFINITY>> nodes;
+		for (ULONG node = 0; node <= highest_node; node++)
+		{
+			GROUP_AFFINITY node_affinity = {};
+			if (GetNumaNodeProcessorMaskEx((USHORT)node, &node_affinity))
+			{
+				KAFFINITY mask = single_group ? node_affinity.Mask & (KAFFINITY)process_mask : node_affinity.Mask;
+				nodes.push_back(processor_affinities(node_affinity.Group, mask));
+			}
+		}
+		// no topology, a single node holding every processor the calling thread may run on
+		if (nodes.empty())
+		{
+			GROUP_AFFINITY current = {};
+			if (!GetThreadGroupAffinity(GetCurrentThread(), &current))
+			{
+				return order;
+			}
+			nodes.push_back(processor_affinities(current.Group, current.Mask));
+		}
+		size_t longest = 0;
+		for (auto& processors : nodes)
+		{
+			longest = std::max(longest, processors.size());
+			if (policy == AffinityPolicy::COMPACT)
+			{
+				order.insert(order.end(), processors.begin(), processors.end());
+			}
+		}
+		if (policy == AffinityPolicy::SCATTER)
+		{
+			for (size_t idx = 0; idx < longest; idx++)
+			{
+				for (auto& processors : nodes)
+				{
+					if (idx < processors.size())
+					{
+						order.push_back(processors[idx]);
+					}
+				}
+			}
+		}
+		return order;
+	}
+
+	// splits [0, count) into ranges of grain and blocks until every range has run, the caller helps
+	template <typename F>
+	void JobSystem::parallel_for(const size_t& count, const size_t& grain, const F& body)
+	{
+		assert(grain > 0);
+		JobCounter fence;
+		auto trampoline = [](void* context, size_t start, size_t end)
+		{
+			(*static_cast<const F*>(context))(start, end);
+		};
+		for (size_t start = 0; start < count; start += grain)
+		{
+			submit(trampoline, (void*)&body, start, std::min(start + grain, count), fence);
+		}
+		wait(fence);
+	}
+
+	// explicit fence, the waiting thread executes queued jobs instead of blocking
+	void JobSystem::wait(const JobCounter& fence)
+	{
+		while (!fence.done())
+		{
+			if (!try_execute())
+			{
+				// a parked job that could not be queued again when its dependency was reached is released here
+				release_parked();
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	// own queue first, newest job first, then steal the oldest unpinned job of another queue
+	bool JobSystem::try_execute()
+	{
+		size_t own = thread_index();
+		Job job;
+		bool found = queues[own]->pop(job);
+		for (size_t offset = 1; !found && offset < queues.size(); offset++)
+		{
+			found = queues[(own + offset) % queues.size()]->steal(job);
+		}
+		if (!found)
+		{
+			return false;
+		}
+		if (job.pinned)
+		{
+			pinned_jobs[own].fetch_sub(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			stealable_jobs.fetch_sub(1, std::memory_order_relaxed);
+		}
+		if (job.dependency != nullptr && !job.dependency->done())
+		{
+			// not ready yet, parked so idle workers do not keep picking it up
+			if (park(job))
+			{
+				return false;
+			}
+			wait(*job.dependency);
+		}
+		execute(job);
+		return true;
+	}
+
+	bool JobSystem::park(const Job& job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(parked_mutex);
+			if (parked.size() == parked.capacity())
+			{
+				return false;
+			}
+			parked.push_back(job);
+			parked_count.fetch_add(1);
+		}
+		// the dependency may have been reached before the job was parked, see execute
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (job.dependency->done())
+		{
+			release_parked();
+		}
+		return true;
+	}
+
+	// queues every parked job whose dependency is reached on the calling thread's queue
+	void JobSystem::release_parked()
+	{
+		if (parked_count.load() == 0)
+		{
+			return;
+		}
+		bool released = false;
+		{
+			std::lock_guard<std::mutex> lock(parked_mutex);
+			size_t kept = 0;
+			for (size_t idx = 0; idx < parked.size(); idx++)
+			{
+				stealable_jobs.fetch_add(1, std::memory_order_release);
+				if (parked[idx].dependency->done() && queues[thread_index()]->push(parked[idx]))
+				{
+					released = true;
+					continue;
+				}
+				stealable_jobs.fetch_sub(1, std::memory_order_relaxed);
+				parked[kept++] = parked[idx];
+			}
+			parked.erase(parked.begin() + kept, parked.end());
+			parked_count = (uint32_t)kept;
+		}
+		if (released)
+		{
+			wake_workers();
+		}
+	}
+
+	void JobSystem::execute(const Job& job)
+	{
+		job.function(job.context, job.start, job.end);
+		if (job.counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			// a reached counter may be the dependency of parked jobs
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			release_parked();
+		}
+	}
+
+	void JobSystem::worker_loop(const size_t& index)
+	{
+		job_worker_index = index;
+		while (true)
+		{
+			if (try_execute())
+			{
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(sleep_mutex);
+			wake_condition.wait(lock, [this, index] { return stop || stealable_jobs.load(std::memory_order_acquire) > 0 || pinned_jobs[index].load(std::memory_order_acquire) > 0; });
+			if (stop)
+			{
+				return;
+			}
+		}
+	}
+}
+#endif
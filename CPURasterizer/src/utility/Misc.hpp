@@ -13,11 +13,20 @@ namespace Guarneri {
 			main_light = DirectionalLight();
 			render_flag = RenderFlag::DISABLE;
 			persample_op_flag = PerSampleOperation::SCISSOR_TEST | PerSampleOperation::STENCIL_TEST | PerSampleOperation::DEPTH_TEST | PerSampleOperation::BLENDING;
-			culling_clipping_flag = CullingAndClippingFlag::APP_FRUSTUM_CULLING | CullingAndClippingFlag::NEAR_PLANE_CLIPPING | CullingAndClippingFlag::SCREEN_CLIPPING | CullingAndClippingFlag::BACK_FACE_CULLING;
+			culling_clipping_flag = CullingAndClippingFlag::APP_FRUSTUM_CULLING | CullingAndClippingFlag::NEAR_PLANE_CLIPPING | CullingAndClippingFlag::GUARD_BAND_CLIPPING | CullingAndClippingFlag::BACK_FACE_CULLING | CullingAndClippingFlag::HIZ_CULLING | CullingAndClippingFlag::TILE_OVERLAP_CULLING;
 			workflow = PBRWorkFlow::Metallic;
 			shadow_bias = 0.02f;
 			enable_shadow = true;
 			pcf_on = true;
+			raster_block_size = DEFAULT_RASTER_BLOCK_SIZE;
+			depth_prepass = false;
+			guard_band = DEFAULT_GUARD_BAND;
+			tile_calibration = false;
+			frame_pipelining = false;
+			thread_affinity = AffinityPolicy::NONE;
+			buffer_layout = BufferLayout::LINEAR;
+			depth_format = DepthFormat::D32F;
+			shadow_format = DepthFormat::D32F;
 		}
 
 		float cam_near;
@@ -33,6 +42,24 @@ namespace Guarneri {
 		bool enable_shadow;
 		bool pcf_on;
 		float shadow_bias;
+		// 0 or 1 disables block trivial accept/reject
+		uint32_t raster_block_size;
+		// lay down opaque depth first so each pixel is shaded at most once
+		bool depth_prepass;
+		// triangles are only clipped where they leave [-guard_band * w, guard_band * w] in x or y, at least 1 and at most
+		// what the fixed point range of the viewport allows
+		float guard_band;
+		// time the first scene with several tile layouts at startup and keep the fastest
+		bool tile_calibration;
+		// rasterize frame N while frame N + 1 is recorded, the window shows frames one frame late
+		bool frame_pipelining;
+		// pin the workers and give each one a fixed band of tiles
+		AffinityPolicy thread_affinity;
+		// memory layout of the depth, stencil, shadow and color targets
+		BufferLayout buffer_layout;
+		// storage of the depth target and of the shadowmap, D16 is plenty for shadows
+		DepthFormat depth_format;
+		DepthFormat shadow_format;
 		PBRWorkFlow workflow;
 		ColorSpace color_space;
 	};